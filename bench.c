@@ -0,0 +1,381 @@
+/*
+   Benchmarks for the hot paths on synthetic canvases, built with
+   'make bench'. main.c includes this instead of its own main when
+   DRAW_BENCH is defined, so the static functions can be called directly.
+   No window gets opened, results are written as json.
+
+   bench [-w width] [-h height] [-e entropy] [-b block] [-n reps] [-r radius] [-m] [-p] [-o out.json]
+*/
+#include <stdatomic.h>
+
+#define BENCH_NAME_X "x"
+#define BENCH_NAME_Y "y"
+
+typedef struct BenchConfig {
+    int32_t width;
+    int32_t height;
+    int32_t entropy; /* Bits of color per block, 0 gives a single color */
+    int32_t block; /* Side of the blocks that share one color, 1 is noise */
+    int32_t reps;
+    float radius;
+    bool merge_rects;
+    bool palette;
+    bool compress;
+    const char* out_path;
+    const char* js_path; /* Export output, read back by the import */
+} BenchConfig;
+
+typedef struct BenchResult {
+    const char* name;
+    int32_t reps;
+    double total_seconds;
+    double min_seconds;
+    uint64_t pixels; /* Per rep */
+    uint64_t bytes; /* Per rep */
+    uint64_t allocations; /* Over all reps */
+    uint64_t peak_rss; /* Of the process after this bench */
+} BenchResult;
+
+/*
+   The bench target links with -Wl,--wrap for these, so every heap
+   allocation of the app and the libraries compiled into it is counted.
+*/
+static _Atomic uint64_t bench_allocations;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+static inline uint32_t bench_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+   Odd multiplier so every palette index gets its own color, the xor keeps
+   index 0 from being black which the export would skip.
+*/
+static inline Color bench_palette_color(uint32_t index) {
+    uint32_t rgb = (index * 2654435761u ^ 0x3366CC) & 0xFFFFFF;
+    return (Color){ rgb >> 16, rgb >> 8 & 0xFF, rgb & 0xFF, 255 };
+}
+
+/* Blocks of random palette colors, RGBA */
+static uint8_t* bench_generate_pixels(const BenchConfig* config) {
+    int32_t w = config->width;
+    int32_t h = config->height;
+    int32_t blocks_x = (w + config->block - 1) / config->block;
+    uint32_t color_mask = config->entropy >= 32 ? 0xFFFFFFFF : (1u << config->entropy) - 1;
+
+    Color* pixels = malloc((size_t)w * h * sizeof(Color));
+    Color* blocks = malloc((size_t)blocks_x * sizeof(Color));
+    if (!pixels || !blocks) {
+        free(pixels);
+        free(blocks);
+        return NULL;
+    }
+
+    uint32_t rng = 0x12345678;
+    for (int32_t y = 0; y < h; y++) {
+        if (y % config->block == 0) {
+            for (int32_t i = 0; i < blocks_x; i++) blocks[i] = bench_palette_color(bench_random(&rng) & color_mask);
+        }
+        for (int32_t x = 0; x < w; x++) pixels[(size_t)y * w + x] = blocks[x / config->block];
+    }
+
+    free(blocks);
+    return (uint8_t*)pixels;
+}
+
+static uint64_t get_file_size(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size > 0 ? (uint64_t)size : 0;
+}
+
+/* Call between bench_rep_begin and bench_rep_end, setup outside of it isnt timed */
+typedef struct BenchTimer {
+    BenchResult* result;
+    double start;
+    uint64_t allocations;
+} BenchTimer;
+
+static inline BenchTimer bench_rep_begin(BenchResult* result) {
+    return (BenchTimer){ result, platGetTime(), atomic_load(&bench_allocations) };
+}
+
+static inline void bench_rep_end(BenchTimer timer) {
+    double elapsed = platGetTime() - timer.start;
+    BenchResult* r = timer.result;
+    r->allocations += atomic_load(&bench_allocations) - timer.allocations;
+    r->total_seconds += elapsed;
+    if (r->reps == 0 || elapsed < r->min_seconds) r->min_seconds = elapsed;
+    r->reps++;
+}
+
+static void bench_export(Context* ctx, const BenchConfig* config, BenchResult* result) {
+    for (int32_t i = 0; i < config->reps; i++) {
+        FILE* file = fopen(config->js_path, "wb");
+        if (!file) {
+            fprintf(stderr, "Failed to open %s\n", config->js_path);
+            return;
+        }
+
+        BenchTimer timer = bench_rep_begin(result);
+        image_to_javascript(ctx, file, BENCH_NAME_X, BENCH_NAME_Y);
+        fclose(file);
+        bench_rep_end(timer);
+    }
+
+    result->pixels = (uint64_t)config->width * config->height;
+    result->bytes = get_file_size(config->js_path);
+}
+
+static void bench_import(Context* ctx, const BenchConfig* config, BenchResult* result) {
+    for (int32_t i = 0; i < config->reps; i++) {
+        BenchTimer timer = bench_rep_begin(result);
+        bool ok = load_javascript_file(ctx, config->js_path);
+        bench_rep_end(timer);
+        if (!ok) return;
+    }
+
+    result->pixels = (uint64_t)ctx->new_image_width * ctx->new_image_height;
+    result->bytes = get_file_size(config->js_path);
+}
+
+/* Not in the palette because of the alpha */
+static const Color bench_fill_color = { 255, 0, 0, 254 };
+
+static uint64_t count_pixels(Context* ctx, Color c) {
+    uint32_t packed = pack_color(c);
+    uint64_t count = 0;
+    for (int32_t y = 0; y < ctx->new_image_height; y++) {
+        for (int32_t x = 0; x < ctx->new_image_width; x++) count += canvas_get(&ctx->canvas, x, y) == packed;
+    }
+    return count;
+}
+
+/*
+   Every fill gets its own save state like in the app, so the tiles are
+   shared and get copied each time. Undoing it brings the generated image
+   back for the next rep, that undo is the undo benchmark.
+*/
+static void bench_bucket_fill_and_undo(Context* ctx, const BenchConfig* config, BenchResult* fill_result, BenchResult* undo_result) {
+    Vector2I center = { config->width / 2, config->height / 2 };
+    uint64_t pixels = 0;
+
+    for (int32_t i = 0; i < config->reps; i++) {
+        new_save_state(ctx, SAVE_STATE_TYPE_BUCKET_FILL);
+
+        BenchTimer timer = bench_rep_begin(fill_result);
+        bucket_fill(ctx, center, bench_fill_color);
+        bench_rep_end(timer);
+
+        if (i == 0) pixels = count_pixels(ctx, bench_fill_color);
+
+        timer = bench_rep_begin(undo_result);
+        undo(ctx);
+        bench_rep_end(timer);
+    }
+
+    fill_result->pixels = undo_result->pixels = pixels;
+    fill_result->bytes = undo_result->bytes = pixels * sizeof(uint32_t);
+}
+
+static void bench_draw_circle(Context* ctx, const BenchConfig* config, BenchResult* result) {
+    uint32_t rng = 0x9E3779B9;
+
+    new_save_state(ctx, SAVE_STATE_TYPE_BRUSH);
+    for (int32_t i = 0; i < config->reps; i++) {
+        Vector2I pos = {
+            bench_random(&rng) % config->width,
+            bench_random(&rng) % config->height
+        };
+
+        BenchTimer timer = bench_rep_begin(result);
+        draw_circle(ctx, pos, config->radius, i % 2 ? RED : BLUE);
+        bench_rep_end(timer);
+    }
+    finish_save_state(ctx);
+
+    result->pixels = (uint64_t)(PI * config->radius * config->radius);
+    result->bytes = result->pixels * sizeof(uint32_t);
+}
+
+static void write_bench_json(FILE* file, const BenchConfig* config, const BenchResult* results, int32_t result_count) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"config\": { \"width\": %d, \"height\": %d, \"entropy\": %d, \"block\": %d, "
+                  "\"reps\": %d, \"radius\": %.2f, \"merge_rects\": %s, \"palette\": %s, \"compress\": %s, \"threads\": %u },\n",
+            config->width, config->height, config->entropy, config->block,
+            config->reps, config->radius, config->merge_rects ? "true" : "false",
+            config->palette ? "true" : "false", config->compress ? "true" : "false", platGetCoreCount());
+    fprintf(file, "  \"benchmarks\": [\n");
+
+    for (int32_t i = 0; i < result_count; i++) {
+        const BenchResult* r = &results[i];
+        double mean = r->reps > 0 ? r->total_seconds / r->reps : 0.0;
+        double pixels = r->pixels > 0 ? (double)r->pixels : 1.0;
+
+        fprintf(file, "    { \"name\": \"%s\", \"reps\": %d, \"mean_ms\": %.4f, \"min_ms\": %.4f, "
+                      "\"pixels\": %llu, \"bytes\": %llu, \"ns_per_pixel\": %.4f, \"min_ns_per_pixel\": %.4f, "
+                      "\"mb_per_s\": %.2f, \"allocations_per_rep\": %.2f, \"peak_rss_bytes\": %llu }%s\n",
+                r->name, r->reps, mean * 1e3, r->min_seconds * 1e3,
+                (unsigned long long)r->pixels, (unsigned long long)r->bytes,
+                mean * 1e9 / pixels, r->min_seconds * 1e9 / pixels,
+                mean > 0.0 ? r->bytes / mean / (1024.0 * 1024.0) : 0.0,
+                r->reps > 0 ? (double)r->allocations / r->reps : 0.0,
+                (unsigned long long)r->peak_rss, i + 1 < result_count ? "," : "");
+    }
+
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"peak_rss_bytes\": %llu\n", (unsigned long long)platGetPeakMemory());
+    fprintf(file, "}\n");
+}
+
+static void print_bench_usage(void) {
+    fprintf(stderr,
+        "usage: bench [options]\n"
+        "  -w <width>      canvas width (default 2048)\n"
+        "  -h <height>     canvas height (default 2048)\n"
+        "  -e <bits>       color entropy per block, 0 is a single color (default 8)\n"
+        "  -b <block>      side of the same colored blocks, 1 is noise (default 4)\n"
+        "  -n <reps>       repetitions of every benchmark (default 10)\n"
+        "  -r <radius>     draw_circle radius (default 32)\n"
+        "  -m              export with merged rects\n"
+        "  -p              palette export\n"
+        "  -z              compressed palette export\n"
+        "  -o <path>       json output (default bench.json)\n");
+}
+
+static bool parse_bench_args(int argc, char** argv, BenchConfig* config) {
+    *config = (BenchConfig){
+        .width = 2048,
+        .height = 2048,
+        .entropy = 8,
+        .block = 4,
+        .reps = 10,
+        .radius = 32.0f,
+        .out_path = "bench.json",
+        .js_path = "bench_export.js",
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-m") == 0) {
+            config->merge_rects = true;
+            continue;
+        }
+        if (strcmp(arg, "-p") == 0) {
+            config->palette = true;
+            continue;
+        }
+        if (strcmp(arg, "-z") == 0) {
+            config->compress = true;
+            continue;
+        }
+        if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc) {
+            fprintf(stderr, "Unknown option or missing value: %s\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+
+        switch (arg[1]) {
+            case 'w': config->width = atoi(value); break;
+            case 'h': config->height = atoi(value); break;
+            case 'e': config->entropy = atoi(value); break;
+            case 'b': config->block = atoi(value); break;
+            case 'n': config->reps = atoi(value); break;
+            case 'r': config->radius = strtof(value, NULL); break;
+            case 'o': config->out_path = value; break;
+            default:
+                fprintf(stderr, "Unknown option: %s\n", arg);
+                return false;
+        }
+    }
+
+    return config->width > 0 && config->height > 0 && config->block > 0 && config->reps > 0 &&
+           config->entropy >= 0 && config->radius > 0.0f;
+}
+
+int32_t main(int argc, char** argv) {
+    BenchConfig config;
+    if (!parse_bench_args(argc, argv, &config)) {
+        print_bench_usage();
+        return 1;
+    }
+
+    Context ctx = {0};
+    ctx.ignore_color = BLACK;
+    ctx.export_scale = 1.0f;
+    ctx.export_merge_rects = config.merge_rects;
+    ctx.export_palette = config.palette;
+    ctx.export_compress = config.compress;
+    ctx.scratch_arena = arenaCreate(GiB(1), MiB(1));
+    ctx.history = history_create(HISTORY_BUDGET, release_save_state, &ctx);
+
+    uint8_t* pixels = bench_generate_pixels(&config);
+    if (!pixels || !create_canvas(&ctx, config.width, config.height, pixels)) {
+        fprintf(stderr, "Failed to create a %dx%d canvas\n", config.width, config.height);
+        return 1;
+    }
+
+    BenchResult results[] = {
+        { .name = "image_to_javascript" },
+        { .name = "load_from_javascript" },
+        { .name = "bucket_fill" },
+        { .name = "undo" },
+        { .name = "draw_circle" },
+    };
+
+    bench_export(&ctx, &config, &results[0]);
+    results[0].peak_rss = platGetPeakMemory();
+
+    bench_import(&ctx, &config, &results[1]);
+    results[1].peak_rss = platGetPeakMemory();
+
+    /* The import canvas can be a bit bigger, the rest runs on the generated one again */
+    create_canvas(&ctx, config.width, config.height, pixels);
+
+    bench_bucket_fill_and_undo(&ctx, &config, &results[2], &results[3]);
+    results[2].peak_rss = results[3].peak_rss = platGetPeakMemory();
+
+    bench_draw_circle(&ctx, &config, &results[4]);
+    results[4].peak_rss = platGetPeakMemory();
+
+    FILE* file = fopen(config.out_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", config.out_path);
+        return 1;
+    }
+    write_bench_json(file, &config, results, ARRAY_LEN(results));
+    fclose(file);
+    fprintf(stderr, "Wrote %s\n", config.out_path);
+
+    remove(config.js_path);
+    free(pixels);
+    history_destroy(ctx.history);
+    free_canvas(&ctx);
+    arenaDestroy(ctx.scratch_arena);
+    return 0;
+}
@@ -0,0 +1,440 @@
+#include "canvas.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+bool canvas_create(Canvas* canvas, int32_t width, int32_t height, uint32_t color) {
+    *canvas = (Canvas){0};
+    if (width <= 0 || height <= 0 || width > CANVAS_MAX_SIZE || height > CANVAS_MAX_SIZE) {
+        fprintf(stderr, "Invalid canvas size %dx%d\n", width, height);
+        return false;
+    }
+
+    canvas->width = width;
+    canvas->height = height;
+    canvas->tiles_x = (width + CANVAS_TILE_MASK) >> CANVAS_TILE_SHIFT;
+    canvas->tiles_y = (height + CANVAS_TILE_MASK) >> CANVAS_TILE_SHIFT;
+
+    size_t tile_count = (size_t)canvas->tiles_x * canvas->tiles_y;
+    canvas->arena = arenaCreate(CANVAS_ARENA_RESERVE, MiB(1));
+    if (!canvas->arena) {
+        fprintf(stderr, "Failed to create canvas arena\n");
+        return false;
+    }
+
+    canvas->tiles = PUSH_ARRAY(canvas->arena, CanvasTile*, tile_count);
+    canvas->uniform = PUSH_ARRAY_NZ(canvas->arena, uint32_t, tile_count);
+    canvas->base_tiles = PUSH_ARRAY(canvas->arena, CanvasTile*, tile_count);
+    canvas->base_uniform = PUSH_ARRAY_NZ(canvas->arena, uint32_t, tile_count);
+    if (!canvas->tiles || !canvas->uniform || !canvas->base_tiles || !canvas->base_uniform) {
+        fprintf(stderr, "Failed to allocate canvas tiles\n");
+        canvas_destroy(canvas);
+        return false;
+    }
+
+    for (size_t i = 0; i < tile_count; i++) canvas->uniform[i] = canvas->base_uniform[i] = color;
+    return true;
+}
+
+void canvas_destroy(Canvas* canvas) {
+    if (canvas->arena) arenaDestroy(canvas->arena);
+    *canvas = (Canvas){0};
+}
+
+/* Every span fill ends up here, so this one gets wide stores */
+static inline void fill_u32(uint32_t* dst, int32_t count, uint32_t value) {
+    int32_t i = 0;
+#if defined(__AVX2__)
+    __m256i wide = _mm256_set1_epi32((int32_t)value);
+    for (; i + 8 <= count; i += 8) _mm256_storeu_si256((__m256i*)(dst + i), wide);
+#endif
+#if defined(__SSE2__)
+    __m128i quad = _mm_set1_epi32((int32_t)value);
+    for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i*)(dst + i), quad);
+#endif
+    for (; i < count; i++) dst[i] = value;
+}
+
+static void unref_tile(Canvas* canvas, CanvasTile* t) {
+    if (--t->refs > 0) return;
+    *(CanvasTile**)t = canvas->free_tiles;
+    canvas->free_tiles = t;
+    canvas->tile_count--;
+}
+
+static void release_tile(Canvas* canvas, int32_t tile, uint32_t color) {
+    CanvasTile* t = canvas->tiles[tile];
+    if (t) {
+        unref_tile(canvas, t);
+        canvas->tiles[tile] = NULL;
+    }
+    canvas->uniform[tile] = color;
+}
+
+/* Pixels are left as they are, refs is 1 */
+static CanvasTile* alloc_tile(Canvas* canvas) {
+    CanvasTile* t = canvas->free_tiles;
+    if (t) canvas->free_tiles = *(CanvasTile**)t;
+    else t = PUSH_STRUCT_NZ(canvas->arena, CanvasTile);
+    if (!t) {
+        fprintf(stderr, "Out of canvas memory\n");
+        return NULL;
+    }
+
+    t->refs = 1;
+    canvas->tile_count++;
+    return t;
+}
+
+uint32_t* canvas_tile_pixels(Canvas* canvas, int32_t tile_x, int32_t tile_y) {
+    int32_t tile = tile_y * canvas->tiles_x + tile_x;
+    CanvasTile* shared = canvas->tiles[tile];
+    if (shared && shared->refs == 1) return shared->pixels;
+
+    CanvasTile* t = alloc_tile(canvas);
+    if (!t) return NULL;
+
+    /* Someone else still looks at the old pixels, so this gets its own copy */
+    if (shared) {
+        memcpy(t->pixels, shared->pixels, sizeof(t->pixels));
+        unref_tile(canvas, shared);
+    }
+    else {
+        fill_u32(t->pixels, CANVAS_TILE_PIXELS, canvas->uniform[tile]);
+    }
+
+    canvas->tiles[tile] = t;
+    return t->pixels;
+}
+
+void canvas_compact(Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h) {
+    if (w <= 0 || h <= 0) return;
+
+    int32_t tile_x0 = x >> CANVAS_TILE_SHIFT;
+    int32_t tile_y0 = y >> CANVAS_TILE_SHIFT;
+    int32_t tile_x1 = (x + w - 1) >> CANVAS_TILE_SHIFT;
+    int32_t tile_y1 = (y + h - 1) >> CANVAS_TILE_SHIFT;
+
+    for (int32_t ty = tile_y0; ty <= tile_y1; ty++) {
+        for (int32_t tx = tile_x0; tx <= tile_x1; tx++) {
+            int32_t tile = ty * canvas->tiles_x + tx;
+            CanvasTile* t = canvas->tiles[tile];
+            if (!t) continue;
+
+            /* Edge tiles hang over the canvas, only the part on it counts */
+            int32_t w_on = MIN(CANVAS_TILE_SIZE, canvas->width - (tx << CANVAS_TILE_SHIFT));
+            int32_t h_on = MIN(CANVAS_TILE_SIZE, canvas->height - (ty << CANVAS_TILE_SHIFT));
+
+            uint32_t first = t->pixels[0];
+            bool same = true;
+            for (int32_t py = 0; py < h_on && same; py++) {
+                const uint32_t* row = &t->pixels[py * CANVAS_TILE_SIZE];
+                for (int32_t px = 0; px < w_on; px++) {
+                    if (row[px] != first) {
+                        same = false;
+                        break;
+                    }
+                }
+            }
+            if (same) release_tile(canvas, tile, first);
+        }
+    }
+}
+
+const uint32_t* canvas_row_segment(const Canvas* canvas, int32_t x, int32_t y, int32_t* count, uint32_t* uniform) {
+    int32_t tile = (y >> CANVAS_TILE_SHIFT) * canvas->tiles_x + (x >> CANVAS_TILE_SHIFT);
+    int32_t tile_end = (x | CANVAS_TILE_MASK) + 1;
+    *count = MIN(tile_end, canvas->width) - x;
+
+    const CanvasTile* t = canvas->tiles[tile];
+    if (!t) {
+        *uniform = canvas->uniform[tile];
+        return NULL;
+    }
+    return &t->pixels[(y & CANVAS_TILE_MASK) * CANVAS_TILE_SIZE + (x & CANVAS_TILE_MASK)];
+}
+
+int32_t canvas_scan_right(const Canvas* canvas, int32_t x, int32_t end, int32_t y, uint32_t color, bool equal) {
+    while (x < end) {
+        int32_t count;
+        uint32_t uniform;
+        const uint32_t* row = canvas_row_segment(canvas, x, y, &count, &uniform);
+        count = MIN(count, end - x);
+
+        if (!row) {
+            if ((uniform == color) == equal) return x;
+        }
+        else {
+            for (int32_t i = 0; i < count; i++) {
+                if ((row[i] == color) == equal) return x + i;
+            }
+        }
+        x += count;
+    }
+    return x;
+}
+
+int32_t canvas_scan_left(const Canvas* canvas, int32_t x, int32_t begin, int32_t y, uint32_t color, bool equal) {
+    while (x >= begin) {
+        /* Segment from the start of the tile row up to x */
+        int32_t seg_begin = MAX(x & ~CANVAS_TILE_MASK, begin);
+        int32_t count;
+        uint32_t uniform;
+        const uint32_t* row = canvas_row_segment(canvas, seg_begin, y, &count, &uniform);
+
+        if (!row) {
+            if ((uniform == color) == equal) return x;
+        }
+        else {
+            for (int32_t i = x - seg_begin; i >= 0; i--) {
+                if ((row[i] == color) == equal) return seg_begin + i;
+            }
+        }
+        x = seg_begin - 1;
+    }
+    return begin - 1;
+}
+
+void canvas_fill_span(Canvas* canvas, int32_t x, int32_t y, int32_t count, uint32_t color) {
+    int32_t end = x + count;
+    int32_t tile_y = y >> CANVAS_TILE_SHIFT;
+
+    while (x < end) {
+        int32_t tile_x = x >> CANVAS_TILE_SHIFT;
+        int32_t n = MIN((x | CANVAS_TILE_MASK) + 1, end) - x;
+        int32_t tile = tile_y * canvas->tiles_x + tile_x;
+
+        if (canvas->tiles[tile] || canvas->uniform[tile] != color) {
+            uint32_t* pixels = canvas_tile_pixels(canvas, tile_x, tile_y);
+            if (pixels) fill_u32(&pixels[(y & CANVAS_TILE_MASK) * CANVAS_TILE_SIZE + (x & CANVAS_TILE_MASK)], n, color);
+        }
+        x += n;
+    }
+}
+
+void canvas_fill_rect(Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+    if (w <= 0 || h <= 0) return;
+
+    int32_t tile_x0 = x >> CANVAS_TILE_SHIFT;
+    int32_t tile_y0 = y >> CANVAS_TILE_SHIFT;
+    int32_t tile_x1 = (x + w - 1) >> CANVAS_TILE_SHIFT;
+    int32_t tile_y1 = (y + h - 1) >> CANVAS_TILE_SHIFT;
+
+    for (int32_t ty = tile_y0; ty <= tile_y1; ty++) {
+        int32_t y0 = MAX(y, ty << CANVAS_TILE_SHIFT);
+        int32_t y1 = MIN(y + h, (ty + 1) << CANVAS_TILE_SHIFT);
+
+        for (int32_t tx = tile_x0; tx <= tile_x1; tx++) {
+            int32_t x0 = MAX(x, tx << CANVAS_TILE_SHIFT);
+            int32_t x1 = MIN(x + w, (tx + 1) << CANVAS_TILE_SHIFT);
+            int32_t tile = ty * canvas->tiles_x + tx;
+
+            /* Covers the whole tile, or at least everything of it that is on the canvas */
+            bool whole_x = (x0 & CANVAS_TILE_MASK) == 0 && (x1 == (tx + 1) << CANVAS_TILE_SHIFT || x1 == canvas->width);
+            bool whole_y = (y0 & CANVAS_TILE_MASK) == 0 && (y1 == (ty + 1) << CANVAS_TILE_SHIFT || y1 == canvas->height);
+            if (whole_x && whole_y) {
+                release_tile(canvas, tile, color);
+                continue;
+            }
+            if (!canvas->tiles[tile] && canvas->uniform[tile] == color) continue;
+
+            uint32_t* pixels = canvas_tile_pixels(canvas, tx, ty);
+            if (!pixels) continue;
+            for (int32_t py = y0; py < y1; py++) {
+                fill_u32(&pixels[(py & CANVAS_TILE_MASK) * CANVAS_TILE_SIZE + (x0 & CANVAS_TILE_MASK)], x1 - x0, color);
+            }
+        }
+    }
+}
+
+void canvas_read_rect(const Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t* dst, size_t dst_stride) {
+    for (int32_t row = 0; row < h; row++) {
+        uint32_t* out = dst + (size_t)row * dst_stride;
+        int32_t px = x;
+        while (px < x + w) {
+            int32_t count;
+            uint32_t uniform;
+            const uint32_t* src = canvas_row_segment(canvas, px, y + row, &count, &uniform);
+            count = MIN(count, x + w - px);
+
+            if (src) memcpy(out, src, (size_t)count * sizeof(uint32_t));
+            else fill_u32(out, count, uniform);
+
+            out += count;
+            px += count;
+        }
+    }
+}
+
+/* Tiles the source doesnt change stay uniform, so loading a mostly flat image stays small */
+void canvas_write_rect(Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t* src, size_t src_stride) {
+    if (w <= 0 || h <= 0) return;
+
+    int32_t tile_x0 = x >> CANVAS_TILE_SHIFT;
+    int32_t tile_y0 = y >> CANVAS_TILE_SHIFT;
+    int32_t tile_x1 = (x + w - 1) >> CANVAS_TILE_SHIFT;
+    int32_t tile_y1 = (y + h - 1) >> CANVAS_TILE_SHIFT;
+
+    for (int32_t ty = tile_y0; ty <= tile_y1; ty++) {
+        int32_t y0 = MAX(y, ty << CANVAS_TILE_SHIFT);
+        int32_t y1 = MIN(y + h, (ty + 1) << CANVAS_TILE_SHIFT);
+
+        for (int32_t tx = tile_x0; tx <= tile_x1; tx++) {
+            int32_t x0 = MAX(x, tx << CANVAS_TILE_SHIFT);
+            int32_t x1 = MIN(x + w, (tx + 1) << CANVAS_TILE_SHIFT);
+            int32_t tile = ty * canvas->tiles_x + tx;
+
+            if (!canvas->tiles[tile]) {
+                uint32_t uniform = canvas->uniform[tile];
+                bool same = true;
+                for (int32_t py = y0; py < y1 && same; py++) {
+                    const uint32_t* in = src + (size_t)(py - y) * src_stride + (x0 - x);
+                    for (int32_t i = 0; i < x1 - x0; i++) {
+                        if (in[i] != uniform) {
+                            same = false;
+                            break;
+                        }
+                    }
+                }
+                if (same) continue;
+            }
+
+            uint32_t* pixels = canvas_tile_pixels(canvas, tx, ty);
+            if (!pixels) continue;
+            for (int32_t py = y0; py < y1; py++) {
+                memcpy(&pixels[(py & CANVAS_TILE_MASK) * CANVAS_TILE_SIZE + (x0 & CANVAS_TILE_MASK)],
+                       src + (size_t)(py - y) * src_stride + (x0 - x), (size_t)(x1 - x0) * sizeof(uint32_t));
+            }
+        }
+    }
+}
+
+static inline bool tile_changed(const Canvas* canvas, int32_t tile) {
+    CanvasTile* t = canvas->tiles[tile];
+    return t != canvas->base_tiles[tile] || (!t && canvas->uniform[tile] != canvas->base_uniform[tile]);
+}
+
+int32_t canvas_next_change(const Canvas* canvas, int32_t from) {
+    int32_t tile_count = canvas->tiles_x * canvas->tiles_y;
+    while (from < tile_count && !tile_changed(canvas, from)) from++;
+    return from;
+}
+
+CanvasTileRef canvas_take_change(Canvas* canvas, int32_t tile) {
+    CanvasTileRef old = { canvas->base_tiles[tile], canvas->base_uniform[tile] };
+
+    CanvasTile* t = canvas->tiles[tile];
+    if (t) t->refs++;
+    canvas->base_tiles[tile] = t;
+    canvas->base_uniform[tile] = canvas->uniform[tile];
+    return old;
+}
+
+void canvas_checkpoint(Canvas* canvas) {
+    int32_t tile_count = canvas->tiles_x * canvas->tiles_y;
+    for (int32_t tile = canvas_next_change(canvas, 0); tile < tile_count; tile = canvas_next_change(canvas, tile + 1)) {
+        canvas_release(canvas, canvas_take_change(canvas, tile));
+    }
+}
+
+CanvasTileRef canvas_swap_tile(Canvas* canvas, int32_t tile, CanvasTileRef ref) {
+    CanvasTileRef old = { canvas->tiles[tile], canvas->uniform[tile] };
+
+    if (canvas->base_tiles[tile]) unref_tile(canvas, canvas->base_tiles[tile]);
+    if (ref.tile) ref.tile->refs++;
+    canvas->base_tiles[tile] = ref.tile;
+    canvas->base_uniform[tile] = ref.color;
+
+    canvas->tiles[tile] = ref.tile;
+    canvas->uniform[tile] = ref.color;
+    return old;
+}
+
+void canvas_release(Canvas* canvas, CanvasTileRef ref) {
+    if (ref.tile) unref_tile(canvas, ref.tile);
+}
+
+static inline uint8_t* put_varint(uint8_t* out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline uint32_t get_varint(const uint8_t** in) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = *(*in)++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return value;
+}
+
+#define PACK_TABLE_BITS 9 /* Twice CANVAS_PACK_MAX_COLORS slots */
+
+uint8_t* canvas_pack_tile(const CanvasTile* tile, uint32_t* size) {
+    uint32_t palette[CANVAS_PACK_MAX_COLORS];
+    uint16_t table[1 << PACK_TABLE_BITS] = {0}; /* Color hash to palette slot + 1 */
+    uint32_t palette_count = 0;
+
+    /* Runs first, the palette goes in front of them */
+    uint8_t runs[sizeof(tile->pixels)];
+    uint8_t* out = runs;
+    const uint32_t* pixels = tile->pixels;
+
+    for (int32_t i = 0; i < CANVAS_TILE_PIXELS;) {
+        uint32_t color = pixels[i];
+        int32_t length = 1;
+        while (i + length < CANVAS_TILE_PIXELS && pixels[i + length] == color) length++;
+
+        uint32_t h = (color * 2654435761u) >> (32 - PACK_TABLE_BITS);
+        while (table[h] && palette[table[h] - 1] != color) h = (h + 1) & ((1 << PACK_TABLE_BITS) - 1);
+        if (!table[h]) {
+            if (palette_count == CANVAS_PACK_MAX_COLORS) return NULL;
+            palette[palette_count++] = color;
+            table[h] = (uint16_t)palette_count;
+        }
+
+        /* Two varints of at most two bytes each */
+        if (out + 4 > runs + sizeof(runs) - palette_count * sizeof(uint32_t) - 2) return NULL;
+        out = put_varint(out, (uint32_t)length - 1);
+        out = put_varint(out, table[h] - 1u);
+        i += length;
+    }
+
+    uint32_t run_size = (uint32_t)(out - runs);
+    uint8_t* packed = malloc(2 + palette_count * sizeof(uint32_t) + run_size);
+    if (!packed) return NULL;
+
+    out = put_varint(packed, palette_count);
+    memcpy(out, palette, palette_count * sizeof(uint32_t));
+    out += palette_count * sizeof(uint32_t);
+    memcpy(out, runs, run_size);
+    *size = (uint32_t)(out + run_size - packed);
+    return packed;
+}
+
+CanvasTile* canvas_unpack_tile(Canvas* canvas, const uint8_t* packed) {
+    CanvasTile* t = alloc_tile(canvas);
+    if (!t) return NULL;
+
+    const uint8_t* in = packed;
+    uint32_t palette_count = get_varint(&in);
+    const uint8_t* palette = in;
+    in += palette_count * sizeof(uint32_t);
+
+    for (int32_t i = 0; i < CANVAS_TILE_PIXELS;) {
+        int32_t length = (int32_t)get_varint(&in) + 1;
+        uint32_t color;
+        memcpy(&color, palette + get_varint(&in) * sizeof(uint32_t), sizeof(color));
+        fill_u32(&t->pixels[i], length, color);
+        i += length;
+    }
+    return t;
+}
@@ -0,0 +1,113 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena_allocator.h"
+
+#define CANVAS_TILE_SHIFT 6
+#define CANVAS_TILE_SIZE (1 << CANVAS_TILE_SHIFT)
+#define CANVAS_TILE_MASK (CANVAS_TILE_SIZE - 1)
+#define CANVAS_TILE_PIXELS (CANVAS_TILE_SIZE * CANVAS_TILE_SIZE)
+
+#define CANVAS_MAX_SIZE 16384
+#define CANVAS_ARENA_RESERVE GiB(64) /* Only address space, pages get committed when used */
+#define CANVAS_PACK_MAX_COLORS 256 /* Tiles with more colors dont get packed */
+
+/*
+   RGBA canvas split into 64x64 tiles. A tile only gets pixels once
+   something different gets written into it, until then it is stored as a
+   single color. Pixels are packed the same way as a raylib Color in memory.
+   Tiles come out of one MemArena and freed ones get reused.
+
+   Tiles are reference counted and copied on write. The canvas keeps the
+   tile table of the last checkpoint, which shares its tiles with the
+   current one, so the first write to a tile after a checkpoint copies it
+   and the old version stays around for undo.
+*/
+typedef struct CanvasTile {
+    uint32_t pixels[CANVAS_TILE_PIXELS];
+    uint32_t refs;
+} CanvasTile;
+
+/* One version of a tile, color is only used if tile is NULL */
+typedef struct CanvasTileRef {
+    CanvasTile* tile;
+    uint32_t color;
+} CanvasTileRef;
+
+typedef struct Canvas {
+    int32_t width;
+    int32_t height;
+    int32_t tiles_x;
+    int32_t tiles_y;
+
+    CanvasTile** tiles; /* NULL if the tile is uniform */
+    uint32_t* uniform; /* Color of the tiles without pixels */
+
+    /* Tile table at the last checkpoint, holds a reference on its tiles */
+    CanvasTile** base_tiles;
+    uint32_t* base_uniform;
+
+    MemArena* arena;
+    CanvasTile* free_tiles; /* The first 8 bytes of a free tile point to the next one */
+    uint32_t tile_count; /* Allocated tiles, shared ones count once */
+} Canvas;
+
+bool canvas_create(Canvas* canvas, int32_t width, int32_t height, uint32_t color);
+void canvas_destroy(Canvas* canvas);
+
+/* Tile pixels for writing, a uniform or shared tile gets its own pixels here. NULL if out of memory */
+uint32_t* canvas_tile_pixels(Canvas* canvas, int32_t tile_x, int32_t tile_y);
+/* Turns tiles that ended up one color back into uniform ones */
+void canvas_compact(Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h);
+
+static inline uint32_t canvas_get(const Canvas* canvas, int32_t x, int32_t y) {
+    int32_t tile = (y >> CANVAS_TILE_SHIFT) * canvas->tiles_x + (x >> CANVAS_TILE_SHIFT);
+    const CanvasTile* t = canvas->tiles[tile];
+    if (!t) return canvas->uniform[tile];
+    return t->pixels[(y & CANVAS_TILE_MASK) * CANVAS_TILE_SIZE + (x & CANVAS_TILE_MASK)];
+}
+
+/*
+   Pixels from (x, y) to the end of that tile row. Returns NULL for uniform
+   tiles and puts their color into *uniform instead.
+*/
+const uint32_t* canvas_row_segment(const Canvas* canvas, int32_t x, int32_t y, int32_t* count, uint32_t* uniform);
+
+/* First x in [x, end) where (pixel == color) == equal, MAX(x, end) if there is none */
+int32_t canvas_scan_right(const Canvas* canvas, int32_t x, int32_t end, int32_t y, uint32_t color, bool equal);
+/* Last x in [begin, x] going left where (pixel == color) == equal, begin - 1 if there is none */
+int32_t canvas_scan_left(const Canvas* canvas, int32_t x, int32_t begin, int32_t y, uint32_t color, bool equal);
+
+/* No clipping, callers pass rects that are inside the canvas */
+void canvas_fill_span(Canvas* canvas, int32_t x, int32_t y, int32_t count, uint32_t color);
+void canvas_fill_rect(Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+void canvas_read_rect(const Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t* dst, size_t dst_stride);
+void canvas_write_rect(Canvas* canvas, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t* src, size_t src_stride);
+
+/* Makes the current tiles the checkpoint, O(tiles) */
+void canvas_checkpoint(Canvas* canvas);
+/* First tile index at or after from that changed since the checkpoint, tile count if there is none */
+int32_t canvas_next_change(const Canvas* canvas, int32_t from);
+/* Hands out the checkpoint version of a changed tile and moves the checkpoint up to the current one */
+CanvasTileRef canvas_take_change(Canvas* canvas, int32_t tile);
+/* Puts ref into the canvas and the checkpoint and hands back what was there before */
+CanvasTileRef canvas_swap_tile(Canvas* canvas, int32_t tile, CanvasTileRef ref);
+void canvas_release(Canvas* canvas, CanvasTileRef ref);
+
+/*
+   Tile versions in the undo history are only read again by undo, so they
+   get packed like this: the colors of the tile as a palette, then runs over
+   all pixels as varints (length - 1, palette slot). A stroke over a tile
+   leaves a few long runs, so this is a lot smaller than the 16 KiB tile.
+   NULL if the tile has too many colors or the packed bytes wouldnt be
+   smaller. The bytes are malloced.
+*/
+uint8_t* canvas_pack_tile(const CanvasTile* tile, uint32_t* size);
+/* New tile with refs 1 and the packed pixels, NULL if out of memory */
+CanvasTile* canvas_unpack_tile(Canvas* canvas, const uint8_t* packed);
+
+#endif
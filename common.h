@@ -13,13 +13,19 @@
 
 #include <raylib.h>
 
-#define UNDO_COUNT 10
+#include "canvas.h"
+#include "input.h"
+#include "raster.h"
+#include "profiler.h"
+
+#define HISTORY_BUDGET MiB(256) /* Bytes of undo history to keep */
 #define BRUSH_COLORS_COUNT 2
 
 #define UI_MAX_INPUT_CHARACTERS 100
-#define UI_DIMENSIONS_MAX_INPUT_CHARACTERS 4
+#define UI_DIMENSIONS_MAX_INPUT_CHARACTERS 5
 #define UI_COLOR_PICKER_MENU_MAX_INPUT_CHARS 3
 #define UI_EXPORT_VAR_NAME_MAX_INPUT_CHARS 8
+#define UI_EXPORT_THREADS_MAX_INPUT_CHARS 2
 
 #define UI_CLICK_COOLDOWN 0.4f /* In seconds */
 
@@ -56,24 +62,40 @@ typedef struct Vector2I {
     int32_t y;
 } Vector2I;
 
-typedef struct PixelState {
-    int32_t index;
-    Color color;
-} PixelState;
-
-/* Not sure if i want to use c11 with anonymis stuff */
-typedef struct SafeState {
-    enum SaveStateType type;
+/* Inclusive pixel bounds of everything written since the last upload */
+typedef struct DirtyRect {
     bool valid;
-    union {
-        struct {
-            PixelState* pixels;
-        } brush;
-        struct {
-
-        } bucket_fill;
-    } data;
-} SaveState;
+    int32_t min_x;
+    int32_t min_y;
+    int32_t max_x;
+    int32_t max_y;
+} DirtyRect;
+
+/* Ignore color the page masks were built for */
+typedef struct IgnoredMask {
+    Color ignore_color;
+    bool valid;
+} IgnoredMask;
+
+#define CANVAS_PAGE_SIZE 512 /* Canvas pixels per side of one texture */
+
+/* One texture worth of the canvas, pages that are one color dont have a texture */
+typedef struct CanvasPage {
+    Texture2D tex;
+    Texture2D mask; /* Ignored pixel overlay */
+    bool mask_valid;
+    bool stale; /* Gets fully uploaded the next time it is drawn */
+    bool solid;
+    uint32_t solid_color;
+} CanvasPage;
+
+/* Version of one canvas tile on the other side of a save state */
+typedef struct TileState {
+    int32_t tile;
+    uint32_t packed_size;
+    CanvasTileRef ref; /* ref.tile is NULL while the pixels are packed */
+    uint8_t* packed; /* canvas_pack_tile bytes of the tile, NULL if it isnt packed */
+} TileState;
 
 typedef struct uiFloatingMenu {
     bool visible;
@@ -114,6 +136,7 @@ typedef struct uiState {
 
     uiInputBox export_var_name_x;
     uiInputBox export_var_name_y;
+    uiInputBox export_threads_input;
 } uiState;
 
 typedef struct Context {
@@ -121,8 +144,15 @@ typedef struct Context {
     int32_t window_height;
     int32_t new_image_width;
     int32_t new_image_height;
-    uint8_t* image_data;
-    Texture2D loaded_tex;
+    Canvas canvas;
+    CanvasPage* pages;
+    int32_t pages_x;
+    int32_t pages_y;
+    DirtyRect dirty;
+    uint8_t* upload_buffer; /* Staging for partial texture uploads */
+    size_t upload_buffer_size;
+    IgnoredMask ignored_mask;
+    struct MemArena* scratch_arena; /* Temporary memory, reset after every use */
     float loaded_ratio;
     enum uiMode mode;
     Color clear_color;
@@ -133,30 +163,45 @@ typedef struct Context {
     float brush_size;
     bool export_x_mirrored;
     bool export_one_line;
+    bool export_merge_rects;
+    bool export_palette;
+    bool export_compress; /* Deflated palette export, smallest page */
     bool pick_color_draw;
     bool pick_color_ignore;
     bool draw_ignored_pixels;
-    bool debug_mode;
+    bool debug_mode; /* Also shows the frame time breakdown */
     bool drawing;
     bool above_ui;
     bool enalbe_ui_click_cooldown;
     bool draw_brush_size_debug; /* Holy shit name */
     Vector2 previous_mouse_pos;
     Vector2 current_mouse_pos;
+    InputSampler* input; /* NULL if the cursor can only be read once per frame */
+    InputSample input_samples[INPUT_QUEUE_SIZE]; /* Cursor positions since the last frame */
+    uint32_t input_sample_count;
+    Vector2 stroke_pos; /* Window space end of what the brush painted so far */
+    Vector2I fill_pos; /* Pixel the last fill of this click started at */
+
+    RasterWorker* raster; /* NULL if painting happens on the main thread */
+    bool canvas_locked; /* The main thread may read the canvas right now */
+    Profiler* profiler; /* NULL if it couldnt be allocated, zones are skipped then */
     Camera2D camera;
     float export_scale;
+    int32_t export_threads; /* 0 means one per core */
 
     /* Save State */
-    SaveState save_states[UNDO_COUNT];
-    int32_t save_states_index;
-    uint32_t* pixel_stamp; 
-    uint32_t current_stamp;
+    struct History* history;
+    struct HistoryEntry* recording; /* Save state whose changes are still only on the canvas */
 
     uiState ui_state;
     Texture2D rainbow_circle;
 } Context;
 
+/* pixels is RGBA, NULL gives a black canvas */
+bool create_canvas(Context* ctx, int32_t width, int32_t height, const uint8_t* pixels);
+void write_canvas_png(Context* ctx, const char* path);
 void image_to_javascript(Context* ctx, FILE* fd, char* name_x, char* name_y);
+bool load_javascript_file(Context* ctx, const char* path);
 void load_from_javascript(Context* ctx);
 
 void init_ui(struct Context* ctx);
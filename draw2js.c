@@ -0,0 +1,253 @@
+/*
+   Headless image to javascript converter, same export as the editor but
+   without a window or GL context so it runs on CI machines.
+
+   draw2js [options] <image>...
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION /* zlib for the compressed export */
+#include "stb_image_write.h"
+
+#include "arena_allocator.h"
+#include "platform.h"
+#include "canvas.h"
+#include "javascript.h"
+
+#define DRAW2JS_MAX_THREADS 64
+
+typedef struct Draw2jsArgs {
+    const char* out_dir; /* NULL writes next to the image */
+    const char* name_x;
+    const char* name_y;
+    jsExportOptions options;
+    int32_t threads; /* Files converted at the same time, 0 means one per core */
+
+    char** files;
+    int32_t file_count;
+} Draw2jsArgs;
+
+typedef struct Draw2jsJobs {
+    const Draw2jsArgs* args;
+    jsExportOptions options; /* Per file, single threaded when several files run at once */
+    _Atomic int32_t next;
+    _Atomic int32_t failed;
+    _Atomic uint64_t bytes_written;
+} Draw2jsJobs;
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "usage: draw2js [options] <image>...\n"
+        "  -o <dir>        write the .js files into dir instead of next to the images\n"
+        "  -i <RRGGBB[AA]> ignore color, pixels with it are left out (default 000000)\n"
+        "  -x <name>       variable added to every x position (default x)\n"
+        "  -y <name>       variable added to every y position (default y)\n"
+        "  -s <scale>      size of one pixel (default 1)\n"
+        "  -m              mirror along x\n"
+        "  -r              merge same colored pixels into bigger rects\n"
+        "  -p              palette export, colors once and packed rect tuples\n"
+        "  -z              compressed palette export, deflated base64 blob\n"
+        "  -j <threads>    files converted in parallel (default one per core)\n");
+}
+
+static bool parse_hex_color(const char* text, uint32_t* packed) {
+    size_t length = strlen(text);
+    if (text[0] == '#') {
+        text++;
+        length--;
+    }
+    if (length != 6 && length != 8) return false;
+
+    uint8_t bytes[4] = { 0, 0, 0, 255 };
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        int32_t digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return false;
+        bytes[i / 2] = (uint8_t)(bytes[i / 2] << 4 | digit);
+    }
+
+    /* Same byte order as a raylib Color */
+    memcpy(packed, bytes, sizeof(*packed));
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, Draw2jsArgs* args) {
+    *args = (Draw2jsArgs){
+        .name_x = "x",
+        .name_y = "y",
+        .options = { .scale = 1.0f },
+    };
+    parse_hex_color("000000", &args->options.ignore_color);
+
+    args->files = malloc(sizeof(char*) * argc);
+    if (!args->files) return false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            args->files[args->file_count++] = argv[i];
+            continue;
+        }
+
+        if (strcmp(arg, "-m") == 0) {
+            args->options.x_mirrored = true;
+            continue;
+        }
+        if (strcmp(arg, "-r") == 0) {
+            args->options.merge_rects = true;
+            continue;
+        }
+        if (strcmp(arg, "-p") == 0) {
+            args->options.palette = true;
+            continue;
+        }
+        if (strcmp(arg, "-z") == 0) {
+            args->options.compress = true;
+            continue;
+        }
+
+        if (arg[2] != '\0' || i + 1 >= argc) {
+            fprintf(stderr, "Unknown option or missing value: %s\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+
+        switch (arg[1]) {
+            case 'o': args->out_dir = value; break;
+            case 'x': args->name_x = value; break;
+            case 'y': args->name_y = value; break;
+            case 's': args->options.scale = strtof(value, NULL); break;
+            case 'j': args->threads = atoi(value); break;
+            case 'i':
+                if (!parse_hex_color(value, &args->options.ignore_color)) {
+                    fprintf(stderr, "Invalid ignore color: %s\n", value);
+                    return false;
+                }
+                break;
+            default:
+                fprintf(stderr, "Unknown option: %s\n", arg);
+                return false;
+        }
+    }
+
+    if (args->options.scale <= 0.0f) {
+        fprintf(stderr, "Scale has to be positive\n");
+        return false;
+    }
+    return args->file_count > 0;
+}
+
+/* <out_dir>/<name>.js, or the image path with its extension swapped */
+static void get_output_path(const Draw2jsArgs* args, const char* image, char* out, size_t size) {
+    const char* name = image;
+    for (const char* c = image; *c; c++) {
+        if (*c == '/' || *c == '\\') name = c + 1;
+    }
+    const char* dot = strrchr(name, '.');
+    int32_t base_length = dot ? (int32_t)(dot - name) : (int32_t)strlen(name);
+
+    if (args->out_dir) {
+        snprintf(out, size, "%s/%.*s.js", args->out_dir, base_length, name);
+    }
+    else {
+        int32_t dir_length = (int32_t)(name - image);
+        snprintf(out, size, "%.*s%.*s.js", dir_length, image, base_length, name);
+    }
+}
+
+static bool convert_file(Draw2jsJobs* jobs, const char* image) {
+    const Draw2jsArgs* args = jobs->args;
+
+    int32_t width, height, channels;
+    uint8_t* pixels = stbi_load(image, &width, &height, &channels, 4);
+    if (!pixels) {
+        fprintf(stderr, "%s: %s\n", image, stbi_failure_reason());
+        return false;
+    }
+
+    /* The editor drops alpha on load as well, so both give the same output */
+    for (size_t i = 0; i < (size_t)width * height; i++) pixels[i * 4 + 3] = 255;
+
+    Canvas canvas;
+    bool ok = canvas_create(&canvas, width, height, 0);
+    if (ok) canvas_write_rect(&canvas, 0, 0, width, height, (const uint32_t*)pixels, width);
+    stbi_image_free(pixels);
+    if (!ok) {
+        fprintf(stderr, "%s: failed to create canvas\n", image);
+        return false;
+    }
+
+    char path[4096];
+    get_output_path(args, image, path, sizeof(path));
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "%s: failed to open %s\n", image, path);
+        canvas_destroy(&canvas);
+        return false;
+    }
+
+    jsExportResult result = js_export_canvas(&canvas, file, args->name_x, args->name_y, &jobs->options);
+    if (fclose(file) != 0) result.failed = true;
+    canvas_destroy(&canvas);
+
+    if (result.failed) {
+        fprintf(stderr, "%s: failed to write %s\n", image, path);
+        return false;
+    }
+
+    atomic_fetch_add(&jobs->bytes_written, result.bytes_written);
+    return true;
+}
+
+static void run_jobs(void* user_data) {
+    Draw2jsJobs* jobs = user_data;
+
+    for (;;) {
+        int32_t index = atomic_fetch_add(&jobs->next, 1);
+        if (index >= jobs->args->file_count) break;
+        if (!convert_file(jobs, jobs->args->files[index])) atomic_fetch_add(&jobs->failed, 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    Draw2jsArgs args;
+    if (!parse_args(argc, argv, &args)) {
+        print_usage();
+        return 1;
+    }
+
+    double start = platGetTime();
+
+    int32_t thread_count = args.threads > 0 ? args.threads : (int32_t)platGetCoreCount();
+    thread_count = MAX(1, MIN(MIN(thread_count, DRAW2JS_MAX_THREADS), args.file_count));
+
+    Draw2jsJobs jobs = { .args = &args, .options = args.options };
+    /* A single file gets the threads inside the export instead */
+    jobs.options.threads = args.file_count == 1 ? args.threads : 1;
+
+    PlatThread* threads[DRAW2JS_MAX_THREADS] = {0};
+    for (int32_t i = 1; i < thread_count; i++) threads[i] = platThreadCreate(run_jobs, &jobs);
+    run_jobs(&jobs);
+    for (int32_t i = 1; i < thread_count; i++) {
+        if (threads[i]) platThreadJoin(threads[i]);
+    }
+
+    int32_t failed = atomic_load(&jobs.failed);
+    printf("Converted %d of %d files, %llu bytes in %.3fs with %d threads\n",
+            args.file_count - failed, args.file_count,
+            (unsigned long long)atomic_load(&jobs.bytes_written), platGetTime() - start, thread_count);
+
+    free(args.files);
+    return failed > 0 ? 1 : 0;
+}
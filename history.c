@@ -0,0 +1,157 @@
+#include "history.h"
+
+History* history_create(u64 budget, PFN_historyRelease release, void* release_user_data) {
+    MemArena* arena = arenaCreate(HISTORY_ARENA_RESERVE, MiB(1));
+    if (!arena) {
+        fprintf(stderr, "Failed to create history arena\n");
+        return NULL;
+    }
+
+    History* history = PUSH_STRUCT(arena, History);
+    history->arena = arena;
+    history->budget = budget;
+    history->release = release;
+    history->release_user_data = release_user_data;
+    return history;
+}
+
+void history_destroy(History* history) {
+    if (!history) return;
+    arenaDestroy(history->arena);
+}
+
+static void free_chunks(History* history, HistoryEntry* entry) {
+    if (entry->last) {
+        entry->last->next = history->free_chunks;
+        history->free_chunks = entry->first;
+    }
+
+    u64 chunk_bytes = entry->size - sizeof(HistoryEntry);
+    history->used -= chunk_bytes;
+    entry->size -= chunk_bytes;
+    entry->first = entry->last = NULL;
+    entry->count = 0;
+}
+
+static void free_entry(History* history, HistoryEntry* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else history->oldest = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else history->newest = entry->prev;
+
+    if (history->release) history->release(entry, history->release_user_data);
+    free_chunks(history, entry);
+
+    history->used -= entry->size;
+    history->entry_count--;
+
+    entry->next = history->free_entries;
+    history->free_entries = entry;
+}
+
+/*
+   Only entries that are applied can go, dropping one that could still be
+   redone would break the ones after it. keep is the entry that is being
+   written to.
+*/
+static void evict(History* history, HistoryEntry* keep) {
+    while (history->used > history->budget && history->current &&
+           history->oldest != history->newest && history->oldest != keep) {
+        HistoryEntry* oldest = history->oldest;
+        if (oldest == history->current) history->current = NULL;
+        free_entry(history, oldest);
+    }
+}
+
+void history_set_budget(History* history, u64 budget) {
+    history->budget = budget;
+    evict(history, NULL);
+}
+
+void history_clear(History* history) {
+    while (history->oldest) free_entry(history, history->oldest);
+    history->current = NULL;
+}
+
+HistoryEntry* history_begin(History* history, u32 kind, u32 stride) {
+    HistoryEntry* redo = history->current ? history->current->next : history->oldest;
+    while (redo) {
+        HistoryEntry* next = redo->next;
+        free_entry(history, redo);
+        redo = next;
+    }
+
+    HistoryEntry* entry = history->free_entries;
+    if (entry) history->free_entries = entry->next;
+    else entry = PUSH_STRUCT_NZ(history->arena, HistoryEntry);
+    if (!entry) return NULL;
+
+    *entry = (HistoryEntry){
+        .prev = history->newest,
+        .size = sizeof(HistoryEntry),
+        .stride = stride,
+        .kind = kind,
+    };
+
+    if (history->newest) history->newest->next = entry;
+    else history->oldest = entry;
+    history->newest = entry;
+    history->current = entry;
+
+    history->used += entry->size;
+    history->entry_count++;
+    evict(history, entry);
+
+    return entry;
+}
+
+static HistoryChunk* push_chunk(History* history, HistoryEntry* entry) {
+    HistoryChunk* chunk = history->free_chunks;
+    if (chunk) history->free_chunks = chunk->next;
+    else chunk = arenaPush(history->arena, HISTORY_CHUNK_SIZE, true);
+    if (!chunk) return NULL;
+
+    u64 data_size = HISTORY_CHUNK_SIZE - (HISTORY_CHUNK_DATA(chunk) - (u8*)chunk);
+    chunk->next = NULL;
+    chunk->count = 0;
+    chunk->capacity = (u32)(data_size / entry->stride);
+
+    if (entry->last) entry->last->next = chunk;
+    else entry->first = chunk;
+    entry->last = chunk;
+
+    entry->size += HISTORY_CHUNK_SIZE;
+    history->used += HISTORY_CHUNK_SIZE;
+    return chunk;
+}
+
+void* history_push(History* history, HistoryEntry* entry) {
+    HistoryChunk* chunk = entry->last;
+
+    if (!chunk || chunk->count == chunk->capacity) {
+        chunk = push_chunk(history, entry);
+        if (!chunk) return NULL;
+        evict(history, entry);
+    }
+
+    entry->count++;
+    return HISTORY_CHUNK_DATA(chunk) + (u64)chunk->count++ * entry->stride;
+}
+
+void history_charge(History* history, HistoryEntry* entry, i64 size) {
+    entry->size += size;
+    history->used += size;
+    if (size > 0) evict(history, entry);
+}
+
+HistoryEntry* history_undo(History* history) {
+    HistoryEntry* entry = history->current;
+    if (entry) history->current = entry->prev;
+    return entry;
+}
+
+HistoryEntry* history_redo(History* history) {
+    HistoryEntry* entry = history->current ? history->current->next : history->oldest;
+    if (entry) history->current = entry;
+    return entry;
+}
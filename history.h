@@ -0,0 +1,77 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "arena_allocator.h"
+
+#define HISTORY_CHUNK_SIZE KiB(2) /* Small so save states of a few tiles dont waste much */
+#define HISTORY_ARENA_RESERVE GiB(64) /* Only address space, pages get committed when used */
+
+/*
+   Undo history that lives in one MemArena. Every entry is a list of fixed
+   size chunks holding items of one stride, so appending to a stroke never
+   reallocs or copies. Chunks and entries that get freed go onto free lists
+   and are reused. Once more than budget bytes are in use the oldest entries
+   get dropped, the entry that is being recorded is never dropped. Items can
+   hold on to memory outside of the history, release gets called before an
+   entry is dropped so the owner can free it.
+*/
+typedef struct HistoryChunk {
+    struct HistoryChunk* next;
+    u32 count; /* Items in this chunk */
+    u32 capacity;
+} HistoryChunk;
+
+#define HISTORY_CHUNK_DATA(chunk) ((u8*)(chunk) + ALIGN_UP_POW2(sizeof(HistoryChunk), ARENA_ALIGN))
+
+typedef struct HistoryEntry {
+    struct HistoryEntry* prev;
+    struct HistoryEntry* next;
+    HistoryChunk* first;
+    HistoryChunk* last;
+    u64 size; /* Bytes this entry counts against the budget */
+    u64 count; /* Items over all chunks */
+    u32 stride;
+    u32 kind;
+} HistoryEntry;
+
+typedef void (*PFN_historyRelease)(HistoryEntry* entry, void* user_data);
+
+typedef struct History {
+    MemArena* arena;
+    HistoryChunk* free_chunks;
+    HistoryEntry* free_entries;
+
+    PFN_historyRelease release;
+    void* release_user_data;
+
+    HistoryEntry* oldest;
+    HistoryEntry* newest;
+    HistoryEntry* current; /* Last applied entry, NULL if everything got undone */
+
+    u64 budget;
+    u64 used;
+    u32 entry_count;
+} History;
+
+History* history_create(u64 budget, PFN_historyRelease release, void* release_user_data);
+void history_destroy(History* history);
+void history_set_budget(History* history, u64 budget);
+/* Drops every entry, used when a different image gets loaded */
+void history_clear(History* history);
+
+/* Drops everything that could be redone and starts a new entry */
+HistoryEntry* history_begin(History* history, u32 kind, u32 stride);
+/* Room for one item at the end of the entry, NULL if out of memory */
+void* history_push(History* history, HistoryEntry* entry);
+
+/* Counts memory the items of an entry keep alive elsewhere against the budget, negative gives some back */
+void history_charge(History* history, HistoryEntry* entry, i64 size);
+
+/* Entry to undo / redo, moves the current entry. NULL if there is nothing */
+HistoryEntry* history_undo(History* history);
+HistoryEntry* history_redo(History* history);
+
+#endif
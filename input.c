@@ -0,0 +1,52 @@
+#include "input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+bool input_queue_push(InputQueue* queue, InputSample sample) {
+    return ring_push(&queue->ring, queue->samples, INPUT_QUEUE_SIZE, sizeof(InputSample), &sample);
+}
+
+bool input_queue_pop(InputQueue* queue, InputSample* sample) {
+    return ring_pop(&queue->ring, queue->samples, INPUT_QUEUE_SIZE, sizeof(InputSample), sample);
+}
+
+static void sample_input(void* user_data) {
+    InputSampler* sampler = user_data;
+    InputSample last = { -1.0f, -1.0f, 0.0 };
+
+    while (atomic_load_explicit(&sampler->running, memory_order_relaxed)) {
+        InputSample sample;
+        if (platGetCursorPos(sampler->window, &sample.x, &sample.y) &&
+            (sample.x != last.x || sample.y != last.y)) {
+            sample.time = platGetTime();
+            if (input_queue_push(&sampler->queue, sample)) last = sample;
+        }
+        platSleep(INPUT_SAMPLE_INTERVAL);
+    }
+}
+
+InputSampler* input_sampler_create(void* window) {
+    float x, y;
+    if (!window || !platGetCursorPos(window, &x, &y)) return NULL;
+
+    InputSampler* sampler = calloc(1, sizeof(InputSampler));
+    if (!sampler) return NULL;
+
+    sampler->window = window;
+    atomic_store(&sampler->running, true);
+    sampler->thread = platThreadCreate(sample_input, sampler);
+    if (!sampler->thread) {
+        fprintf(stderr, "Failed to start input thread, sampling once per frame\n");
+        free(sampler);
+        return NULL;
+    }
+    return sampler;
+}
+
+void input_sampler_destroy(InputSampler* sampler) {
+    if (!sampler) return;
+    atomic_store(&sampler->running, false);
+    platThreadJoin(sampler->thread);
+    free(sampler);
+}
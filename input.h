@@ -0,0 +1,46 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "platform.h"
+#include "ring.h"
+
+#define INPUT_QUEUE_SIZE 1024 /* Power of two, one second of samples at the sample rate */
+#define INPUT_SAMPLE_INTERVAL (1.0 / 1000.0)
+
+typedef struct InputSample {
+    float x; /* Window space like GetMousePosition */
+    float y;
+    double time; /* platGetTime */
+} InputSample;
+
+/* Filled by the sampler thread, emptied by the main thread */
+typedef struct InputQueue {
+    InputSample samples[INPUT_QUEUE_SIZE];
+    Ring ring;
+} InputQueue;
+
+/* false if the queue is full, the sample is dropped then */
+bool input_queue_push(InputQueue* queue, InputSample sample);
+bool input_queue_pop(InputQueue* queue, InputSample* sample);
+
+/*
+   Thread that polls the cursor much faster than the frame rate and queues
+   every position that changed, so strokes dont depend on the FPS.
+   glfw only lets the main thread poll, so the cursor is read from the OS.
+*/
+typedef struct InputSampler {
+    InputQueue queue;
+    PlatThread* thread;
+    void* window;
+    _Atomic bool running;
+} InputSampler;
+
+/* NULL if the platform cant read the cursor off the main thread */
+InputSampler* input_sampler_create(void* window);
+void input_sampler_destroy(InputSampler* sampler);
+
+#endif
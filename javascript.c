@@ -0,0 +1,1173 @@
+#include "javascript.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena_allocator.h"
+#include "darray.h"
+#include "js_writer.h"
+#include "platform.h"
+#include "stb_image.h"
+
+typedef struct jsRect {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+    uint32_t color; /* 0xRRGGBB */
+} jsRect;
+
+/* Canvas pixels are raylib Color bytes in memory, r g b a */
+static inline uint32_t color_to_hex(uint32_t packed) {
+    const uint8_t* c = (const uint8_t*)&packed;
+    return (uint32_t)c[0] << 16 | (uint32_t)c[1] << 8 | (uint32_t)c[2];
+}
+
+/* Start of the palette export, the importer looks for it */
+#define JS_PALETTE_HEADER "((ox, oy, s, p, d) => { for (let i = 0; i < d.length; i += 5) "
+#define JS_WRITER_PALETTE_BUFFER_SIZE KiB(64)
+
+/* Start of the compressed export, same thing */
+#define JS_BLOB_HEADER "((ox, oy, s, p, b) => { "
+#define JS_BLOB_LINE_LENGTH 4096 /* Base64 chars per line, multiple of 4 so every line decodes on its own */
+#define JS_BLOB_QUALITY 8 /* stbi_zlib_compress quality, same default stbi_write_png uses */
+
+/* Part of stb_image_write.h but not declared in its header part */
+unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+/*
+   Hex colors of the palette export in order of first use. Open addressing
+   table from color to index, colors are 24 bit so an empty slot is
+   JS_PALETTE_EMPTY.
+*/
+#define JS_PALETTE_EMPTY 0xFFFFFFFF
+
+typedef struct jsPaletteSlot {
+    uint32_t color;
+    uint32_t index;
+} jsPaletteSlot;
+
+typedef struct jsPalette {
+    jsPaletteSlot* slots;
+    uint32_t shift; /* 32 - log2 of the slot count */
+    uint32_t* colors; /* darray */
+} jsPalette;
+
+static inline uint32_t palette_slot(const jsPalette* palette, uint32_t color) {
+    return (color * 0x9E3779B1u) >> palette->shift;
+}
+
+static bool palette_init(jsPalette* palette) {
+    palette->shift = 32 - 6;
+    palette->slots = malloc(sizeof(jsPaletteSlot) << 6);
+    palette->colors = darrayCreate(uint32_t);
+    if (!palette->slots || !palette->colors) return false;
+
+    memset(palette->slots, 0xFF, sizeof(jsPaletteSlot) << 6);
+    return true;
+}
+
+static void palette_destroy(jsPalette* palette) {
+    free(palette->slots);
+    if (palette->colors) darrayDestroy(palette->colors);
+}
+
+static uint32_t palette_find(const jsPalette* palette, uint32_t color) {
+    uint32_t mask = (1u << (32 - palette->shift)) - 1;
+    for (uint32_t i = palette_slot(palette, color);; i = (i + 1) & mask) {
+        const jsPaletteSlot* slot = &palette->slots[i];
+        if (slot->color == color || slot->color == JS_PALETTE_EMPTY) return slot->index;
+    }
+}
+
+/* Kept at most half full, so a lookup always ends at an empty slot */
+static bool palette_add(jsPalette* palette, uint32_t color) {
+    uint32_t slot_count = 1u << (32 - palette->shift);
+    uint32_t count = (uint32_t)darrayLength(palette->colors);
+
+    if (2 * (count + 1) > slot_count) {
+        jsPaletteSlot* slots = malloc(sizeof(jsPaletteSlot) * slot_count * 2);
+        if (!slots) return false;
+        memset(slots, 0xFF, sizeof(jsPaletteSlot) * slot_count * 2);
+
+        jsPaletteSlot* old = palette->slots;
+        palette->slots = slots;
+        palette->shift--;
+
+        uint32_t mask = slot_count * 2 - 1;
+        for (uint32_t i = 0; i < slot_count; i++) {
+            if (old[i].color == JS_PALETTE_EMPTY) continue;
+            uint32_t j = palette_slot(palette, old[i].color);
+            while (slots[j].color != JS_PALETTE_EMPTY) j = (j + 1) & mask;
+            slots[j] = old[i];
+        }
+        free(old);
+        slot_count *= 2;
+    }
+
+    uint32_t mask = slot_count - 1;
+    uint32_t i = palette_slot(palette, color);
+    while (palette->slots[i].color != JS_PALETTE_EMPTY) {
+        if (palette->slots[i].color == color) return true;
+        i = (i + 1) & mask;
+    }
+
+    palette->slots[i] = (jsPaletteSlot){ color, count };
+    darrayPush(palette->colors, color);
+    return true;
+}
+
+/* What one export call shares with its bands */
+typedef struct jsExport {
+    const Canvas* canvas;
+    const jsExportOptions* options;
+    const char* name_x;
+    const char* name_y;
+    const jsPalette* palette; /* NULL unless options->palette or options->compress */
+} jsExport;
+
+/*
+   Greedy mesher: every pixel that isnt covered yet grows to the right as long
+   as the color matches and then downwards as long as the whole row segment
+   matches. One Canvas.rect per block instead of one per pixel.
+   Returns a darray of the blocks in scan order.
+*/
+static jsRect* mesh_image_rects(const Canvas* canvas, uint32_t ignore) {
+    int32_t w = canvas->width;
+    int32_t h = canvas->height;
+
+    /* One bit per pixel */
+    uint8_t* covered = calloc(((size_t)w * h + 7) / 8, sizeof(uint8_t));
+    if (!covered) {
+        fprintf(stderr, "Failed to allocate export mask\n");
+        return NULL;
+    }
+#define IS_COVERED(i) (covered[(i) >> 3] & (1 << ((i) & 7)))
+
+    jsRect* rects = darrayCreate(jsRect);
+
+    for (int32_t y = 0; y < h; y++) {
+        for (int32_t x = 0; x < w; x++) {
+            size_t index = (size_t)y * w + x;
+            if (IS_COVERED(index)) continue;
+
+            uint32_t packed = canvas_get(canvas, x, y);
+            if (packed == ignore) continue;
+
+            int32_t rect_w = 1;
+            while (x + rect_w < w && !IS_COVERED(index + rect_w) &&
+                   canvas_get(canvas, x + rect_w, y) == packed) {
+                rect_w++;
+            }
+
+            int32_t rect_h = 1;
+            while (y + rect_h < h) {
+                size_t row = (size_t)(y + rect_h) * w;
+                bool same = true;
+                for (int32_t i = x; i < x + rect_w; i++) {
+                    if (IS_COVERED(row + i) || canvas_get(canvas, i, y + rect_h) != packed) {
+                        same = false;
+                        break;
+                    }
+                }
+                if (!same) break;
+                rect_h++;
+            }
+
+            for (int32_t j = y; j < y + rect_h; j++) {
+                for (int32_t i = x; i < x + rect_w; i++) {
+                    size_t bit = (size_t)j * w + i;
+                    covered[bit >> 3] |= 1 << (bit & 7);
+                }
+            }
+
+            jsRect rect = {
+                .x = x,
+                .y = y,
+                .w = rect_w,
+                .h = rect_h,
+                .color = color_to_hex(packed),
+            };
+            darrayPush(rects, rect);
+        }
+    }
+#undef IS_COVERED
+
+    free(covered);
+    return rects;
+}
+
+/* One slice of the export, either image rows or indices into the merged rects */
+typedef struct jsExportBand {
+    const jsExport* export;
+    jsRect* rects;
+    int32_t begin;
+    int32_t end;
+    jsWriter writer;
+    int32_t last_x2; /* The blob stores positions relative to the rect before */
+    int32_t last_y2;
+} jsExportBand;
+
+static inline uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/*
+   Positions are calculated in half pixels because the center of a merged
+   block can lie between two pixels. A 1x1 block gives the same numbers as
+   the old per pixel export.
+*/
+static void put_js_rect(jsExportBand* band, jsRect rect) {
+    const jsExport* export = band->export;
+    const jsExportOptions* options = export->options;
+    jsWriter* writer = &band->writer;
+    int32_t pos_x2 = 2 * rect.x + (rect.w - 1) - 2 * (export->canvas->width / 2);
+    int32_t pos_y2 = -(2 * rect.y + (rect.h - 1) - 2 * (export->canvas->height / 2));
+    if (options->x_mirrored) pos_x2 *= -1;
+
+    /* Scale is applied by the javascript loop, so the tuples stay integers */
+    if (options->compress) {
+        js_writer_put_varint(writer, zigzag(pos_x2 - band->last_x2));
+        js_writer_put_varint(writer, zigzag(pos_y2 - band->last_y2));
+        js_writer_put_varint(writer, (uint32_t)rect.w);
+        js_writer_put_varint(writer, (uint32_t)rect.h);
+        js_writer_put_varint(writer, palette_find(export->palette, rect.color));
+        band->last_x2 = pos_x2;
+        band->last_y2 = pos_y2;
+        return;
+    }
+
+    if (export->palette) {
+        js_writer_put_palette_rect(writer, pos_x2, pos_y2, rect.w, rect.h, palette_find(export->palette, rect.color));
+        return;
+    }
+
+    js_writer_put_rect(writer, export->name_x, export->name_y,
+            pos_x2 * 0.5f * options->scale, pos_y2 * 0.5f * options->scale,
+            (rect.w + 0.5f) * options->scale, (rect.h + 0.5f) * options->scale, rect.color);
+}
+
+static void export_band(void* user_data) {
+    jsExportBand* band = (jsExportBand*)user_data;
+    const jsExport* export = band->export;
+
+    if (band->rects) {
+        for (int32_t i = band->begin; i < band->end; i++) {
+            put_js_rect(band, band->rects[i]);
+        }
+        return;
+    }
+
+    uint32_t ignore = export->options->ignore_color;
+
+    for (int32_t y = band->begin; y < band->end; y++) {
+        int32_t x = 0;
+        while (x < export->canvas->width) {
+            int32_t count;
+            uint32_t uniform;
+            const uint32_t* row = canvas_row_segment(export->canvas, x, y, &count, &uniform);
+
+            /* Whole ignored tile rows get skipped at once */
+            if (!row && uniform == ignore) {
+                x += count;
+                continue;
+            }
+
+            for (int32_t i = 0; i < count; i++) {
+                uint32_t packed = row ? row[i] : uniform;
+                if (packed == ignore) continue;
+
+                jsRect rect = { .x = x + i, .y = y, .w = 1, .h = 1, .color = color_to_hex(packed) };
+                put_js_rect(band, rect);
+            }
+            x += count;
+        }
+    }
+}
+
+/*
+   The palette export replaces all Canvas.rect lines with one expression,
+   every part on its own line so the importer can stream it:
+
+   ((ox, oy, s, p, d) => { for (...) Canvas.rect(ox + d[i] * s / 2, ...); })(<name_x>, <name_y>, <scale>, [
+   "#RRGGBB",
+   ], [
+   <x2>,<y2>,<w>,<h>,<index>,
+   ]),
+
+   Positions are the half pixels from put_js_rect. The origin is passed in
+   so the names cant be shadowed by the parameters of the arrow function.
+*/
+static void put_palette_header(const jsExport* export, jsWriter* writer) {
+    JS_WRITER_PUT_LITERAL(writer, JS_PALETTE_HEADER "Canvas.rect(ox + d[i] * s / 2, oy + d[i + 1] * s / 2, "
+                                  "(d[i + 2] + 0.5) * s, (d[i + 3] + 0.5) * s, {fill: p[d[i + 4]]}); })(");
+    js_writer_put_string(writer, export->name_x, strlen(export->name_x));
+    JS_WRITER_PUT_LITERAL(writer, ", ");
+    js_writer_put_string(writer, export->name_y, strlen(export->name_y));
+
+    char scale[32];
+    int32_t length = snprintf(scale, sizeof(scale), ", %g", export->options->scale);
+    js_writer_put_string(writer, scale, length);
+    JS_WRITER_PUT_LITERAL(writer, ", [\n");
+
+    const uint32_t* colors = export->palette->colors;
+    for (uint64_t i = 0; i < darrayLength(export->palette->colors); i++) {
+        JS_WRITER_PUT_LITERAL(writer, "\"#");
+        js_writer_put_hex6(writer, colors[i]);
+        JS_WRITER_PUT_LITERAL(writer, "\",\n");
+    }
+    JS_WRITER_PUT_LITERAL(writer, "], [\n");
+}
+
+static void put_palette_footer(jsWriter* writer) {
+    JS_WRITER_PUT_LITERAL(writer, "]),\n");
+}
+
+/*
+   The compressed export keeps the palette but packs the tuples as varints,
+   positions relative to the tuple before, and deflates them. The page gets
+   a small inflate so Canvas.rect is still called synchronously in order:
+
+   ((ox, oy, s, p, b) => { <inflate and replay> })(<name_x>, <name_y>, <scale>, [
+   "#RRGGBB",
+   ],
+   "<base64>"+
+   ""),
+*/
+static const char js_blob_decoder[] =
+    "const u = Uint8Array.from(atob(b), c => c.charCodeAt(0)), o = []; let q = 16; const r = n => { let v = 0; "
+    "for (let k = 0; k < n; k++, q++) v |= (u[q >> 3] >> (q & 7) & 1) << k; return v; "
+    "}; const t = l => { const c = Array(16).fill(0), f = [0], y = []; l.forEach(x => c[x]++); "
+    "c[0] = 0; for (let i = 1; i < 16; i++) f[i] = f[i - 1] + c[i - 1]; l.forEach((x, i) => { if (x) y[f[x]++] = i; }); "
+    "return [c, y]; }; const h = ([c, y]) => { for (let n = 1, v = 0, f = 0, i = 0; n < 16; n++) { v |= r(1); "
+    "if (v - c[n] < f) return y[i + v - f]; i += c[n]; f = f + c[n] << 1; v <<= 1; } }; "
+    "const L = [], LE = [], D = [], DE = []; for (let i = 0, a = 3, d = 1; i < 30; i++) { LE[i] = i < 8 || i == 28 ? 0 : (i >> 2) - 1; "
+    "L[i] = i == 28 ? 258 : a; a += 1 << LE[i]; DE[i] = i < 4 ? 0 : (i >> 1) - 1; D[i] = d; "
+    "d += 1 << DE[i]; } for (let last = 0; !last;) { last = r(1); const k = r(2); if (!k) { q = q + 7 & ~7; "
+    "let n = u[q >> 3] | u[(q >> 3) + 1] << 8; q += 32; while (n--) { o.push(u[q >> 3]); "
+    "q += 8; } continue; } let l = [], m = 288; if (k == 1) for (let i = 0; i < 320; i++) l.push(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : i < 288 ? 8 : 5); "
+    "else { m = r(5) + 257; const n = r(5) + 1, e = r(4) + 4, g = Array(19).fill(0); for (let i = 0; i < e; i++) g[[16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15][i]] = r(3); "
+    "const w = t(g); while (l.length < m + n) { const x = h(w); if (x < 16) l.push(x); "
+    "else for (let j = x == 16 ? 3 + r(2) : x == 17 ? 3 + r(3) : 11 + r(7), v = x == 16 ? l[l.length - 1] : 0; j--;) l.push(v); "
+    "} } const a = t(l.slice(0, m)), z = t(l.slice(m)); for (let x; (x = h(a)) != 256;) { if (x < 256) { o.push(x); "
+    "continue; } x -= 257; let n = L[x] + r(LE[x]); const y = h(z), d = D[y] + r(DE[y]); "
+    "while (n--) o.push(o[o.length - d]); } } let i = 0, X = 0, Y = 0; const v = () => { let n = 0, k = 0, c; "
+    "do { c = o[i++]; n |= (c & 127) << k; k += 7; } while (c & 128); return n; }; const zz = () => { const n = v(); "
+    "return n >>> 1 ^ -(n & 1); }; while (i < o.length) { X += zz(); Y += zz(); const w = v(), hh = v(); "
+    "Canvas.rect(ox + X * s / 2, oy + Y * s / 2, (w + 0.5) * s, (hh + 0.5) * s, {fill: p[v()]}); "
+    "}";
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void put_blob(const jsExport* export, jsWriter* writer, const uint8_t* data, size_t length) {
+    JS_WRITER_PUT_LITERAL(writer, JS_BLOB_HEADER);
+    js_writer_put_string(writer, js_blob_decoder, sizeof(js_blob_decoder) - 1);
+    JS_WRITER_PUT_LITERAL(writer, " })(");
+    js_writer_put_string(writer, export->name_x, strlen(export->name_x));
+    JS_WRITER_PUT_LITERAL(writer, ", ");
+    js_writer_put_string(writer, export->name_y, strlen(export->name_y));
+
+    char scale[32];
+    int32_t scale_length = snprintf(scale, sizeof(scale), ", %g, [\n", export->options->scale);
+    js_writer_put_string(writer, scale, scale_length);
+
+    const uint32_t* colors = export->palette->colors;
+    for (uint64_t i = 0; i < darrayLength(export->palette->colors); i++) {
+        JS_WRITER_PUT_LITERAL(writer, "\"#");
+        js_writer_put_hex6(writer, colors[i]);
+        JS_WRITER_PUT_LITERAL(writer, "\",\n");
+    }
+    JS_WRITER_PUT_LITERAL(writer, "],\n");
+
+    char line[1 + JS_BLOB_LINE_LENGTH + 3];
+    int32_t line_length = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t triple = (uint32_t)data[i] << 16;
+        if (i + 1 < length) triple |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length) triple |= data[i + 2];
+
+        if (line_length == 0) line[line_length++] = '"';
+        line[line_length++] = base64_chars[triple >> 18 & 63];
+        line[line_length++] = base64_chars[triple >> 12 & 63];
+        line[line_length++] = i + 1 < length ? base64_chars[triple >> 6 & 63] : '=';
+        line[line_length++] = i + 2 < length ? base64_chars[triple & 63] : '=';
+
+        if (line_length == JS_BLOB_LINE_LENGTH + 1 || i + 3 >= length) {
+            memcpy(&line[line_length], "\"+\n", 3);
+            js_writer_put_string(writer, line, line_length + 3);
+            line_length = 0;
+        }
+    }
+    JS_WRITER_PUT_LITERAL(writer, "\"\"),\n");
+}
+
+/* Varints go into an arena first, deflate wants all of them at once */
+static jsExportResult export_blob(const jsExport* export, FILE* fd, jsRect* rects, int32_t count) {
+    jsExportResult result = { .thread_count = 1 };
+
+    uint64_t pixels_per_item = rects ? 1 : export->canvas->width;
+    MemArena* arena = arenaCreate((uint64_t)count * pixels_per_item * 5 * 5 + MiB(1), MiB(1));
+    jsExportBand band = {
+        .export = export,
+        .rects = rects,
+        .begin = 0,
+        .end = count,
+    };
+    if (!arena || !js_writer_init_arena(&band.writer, arena)) {
+        fprintf(stderr, "Failed to create export arena\n");
+        if (arena) arenaDestroy(arena);
+        result.failed = true;
+        return result;
+    }
+
+    export_band(&band);
+
+    int compressed_length = 0;
+    unsigned char* compressed = NULL;
+    if (!band.writer.failed && band.writer.pos <= INT32_MAX) {
+        compressed = stbi_zlib_compress((unsigned char*)band.writer.buffer, (int)band.writer.pos, &compressed_length, JS_BLOB_QUALITY);
+    }
+    arenaDestroy(arena);
+    if (!compressed) {
+        fprintf(stderr, "Failed to compress export data\n");
+        result.failed = true;
+        return result;
+    }
+
+    jsWriter writer;
+    if (js_writer_init(&writer, fd, JS_WRITER_BUFFER_SIZE)) {
+        put_blob(export, &writer, compressed, compressed_length);
+        js_writer_destroy(&writer);
+        result.bytes_written = writer.bytes_written;
+        result.failed = writer.failed;
+    }
+    else {
+        result.failed = true;
+    }
+
+    free(compressed);
+    return result;
+}
+
+/* Same scan order as the export, so the palette doesnt depend on the thread count */
+static bool build_palette(jsPalette* palette, const Canvas* canvas, const jsRect* rects, int32_t rect_count, uint32_t ignore) {
+    if (rects) {
+        for (int32_t i = 0; i < rect_count; i++) {
+            if (!palette_add(palette, rects[i].color)) return false;
+        }
+        return true;
+    }
+
+    uint32_t last = JS_PALETTE_EMPTY;
+    for (int32_t y = 0; y < canvas->height; y++) {
+        int32_t x = 0;
+        while (x < canvas->width) {
+            int32_t count;
+            uint32_t uniform;
+            const uint32_t* row = canvas_row_segment(canvas, x, y, &count, &uniform);
+
+            for (int32_t i = 0; i < (row ? count : 1); i++) {
+                uint32_t packed = row ? row[i] : uniform;
+                if (packed == ignore) continue;
+
+                uint32_t color = color_to_hex(packed);
+                if (color == last) continue;
+                if (!palette_add(palette, color)) return false;
+                last = color;
+            }
+            x += count;
+        }
+    }
+    return true;
+}
+
+#define JS_EXPORT_BAND_PIXELS (64 * 1024) /* Pixels per band of the threaded export, a few MiB of text */
+#define JS_EXPORT_SLOTS_PER_THREAD 2 /* Bands a worker can have formatted ahead of the file */
+
+/*
+   Bands of the threaded export rotate through a fixed number of slots, band
+   i is formatted into the arena of slot i % slot_count. done is posted once
+   the band is formatted.
+*/
+typedef struct jsExportSlot {
+    jsExportBand band;
+    MemArena* arena;
+    PlatSemaphore* done;
+} jsExportSlot;
+
+typedef struct jsExportQueue {
+    const jsExport* export;
+    jsRect* rects;
+    int32_t count;
+    int32_t items_per_band;
+    int32_t band_count;
+    jsExportSlot* slots;
+    int32_t slot_count;
+    /*
+       Posted by the writing thread once for every band whose slot is free,
+       a worker only takes the next band index after waiting on it. So band i
+       can only be taken after band i - slot_count was written out.
+    */
+    PlatSemaphore* work;
+    _Atomic int32_t next_band;
+} jsExportQueue;
+
+static void format_queued_band(jsExportQueue* queue, int32_t index) {
+    jsExportSlot* slot = &queue->slots[index % queue->slot_count];
+
+    arenaClear(slot->arena);
+    slot->band = (jsExportBand){
+        .export = queue->export,
+        .rects = queue->rects,
+        .begin = (int32_t)MIN((int64_t)queue->count, (int64_t)index * queue->items_per_band),
+        .end = (int32_t)MIN((int64_t)queue->count, ((int64_t)index + 1) * queue->items_per_band),
+    };
+    if (js_writer_init_arena(&slot->band.writer, slot->arena)) export_band(&slot->band);
+    else slot->band.writer.failed = true;
+
+    platSemaphorePost(slot->done);
+}
+
+static void export_queue_worker(void* user_data) {
+    jsExportQueue* queue = (jsExportQueue*)user_data;
+
+    for (;;) {
+        platSemaphoreWait(queue->work);
+        int32_t index = atomic_fetch_add(&queue->next_band, 1);
+        if (index >= queue->band_count) break;
+        format_queued_band(queue, index);
+    }
+}
+
+static void destroy_export_slot(jsExportSlot* slot) {
+    if (slot->arena) arenaDestroy(slot->arena);
+    if (slot->done) platSemaphoreDestroy(slot->done);
+}
+
+/*
+   Workers format small bands into arenas while this thread writes the
+   finished ones out in order, so the file is the same for any thread count.
+   At most thread_count * JS_EXPORT_SLOTS_PER_THREAD bands are in memory at
+   once, workers that get ahead wait for a slot to be written out instead of
+   growing the peak memory with the output size.
+*/
+static void export_bands_threaded(const jsExport* export, FILE* fd, jsRect* rects, int32_t count, int32_t thread_count, jsExportResult* result) {
+    /* Upper bound of one line, reserved address space only gets committed when used */
+    uint64_t line_size = 64 + strlen(export->name_x) + strlen(export->name_y) + 4 * JS_WRITER_MAX_FIXED2;
+    uint64_t pixels_per_item = rects ? 1 : export->canvas->width;
+    uint64_t items_per_band = MAX(1, JS_EXPORT_BAND_PIXELS / pixels_per_item);
+    uint64_t reserve_size = items_per_band * pixels_per_item * line_size + MiB(1);
+
+    jsExportSlot slots[JS_EXPORT_MAX_THREADS * JS_EXPORT_SLOTS_PER_THREAD] = {0};
+    jsExportQueue queue = {
+        .export = export,
+        .rects = rects,
+        .count = count,
+        .items_per_band = (int32_t)items_per_band,
+        .band_count = (int32_t)((count + items_per_band - 1) / items_per_band),
+        .slots = slots,
+    };
+    atomic_init(&queue.next_band, 0);
+
+    int32_t slot_count = MIN(thread_count * JS_EXPORT_SLOTS_PER_THREAD, queue.band_count);
+    queue.work = platSemaphoreCreate();
+    for (int32_t i = 0; queue.work && i < slot_count; i++) {
+        jsExportSlot* slot = &slots[i];
+        slot->arena = arenaCreate(reserve_size, MiB(1));
+        slot->done = platSemaphoreCreate();
+        if (!slot->arena || !slot->done) {
+            fprintf(stderr, "Failed to create export slot %d\n", i);
+            destroy_export_slot(slot);
+            *slot = (jsExportSlot){0};
+            break;
+        }
+        queue.slot_count++;
+    }
+
+    if (queue.slot_count == 0) {
+        if (queue.work) platSemaphoreDestroy(queue.work);
+
+        /* Not even one band arena, stream everything through a normal writer */
+        jsExportBand band = {
+            .export = export,
+            .rects = rects,
+            .begin = 0,
+            .end = count,
+        };
+        if (js_writer_init(&band.writer, fd, JS_WRITER_BUFFER_SIZE)) {
+            export_band(&band);
+            js_writer_destroy(&band.writer);
+            result->bytes_written += band.writer.bytes_written;
+            if (band.writer.failed) result->failed = true;
+        }
+        else {
+            result->failed = true;
+        }
+        return;
+    }
+
+    PlatThread* threads[JS_EXPORT_MAX_THREADS] = {0};
+    int32_t worker_count = 0;
+    for (int32_t i = 0; i < MIN(thread_count, queue.band_count); i++) {
+        threads[worker_count] = platThreadCreate(export_queue_worker, &queue);
+        if (threads[worker_count]) worker_count++;
+    }
+    for (int32_t i = 0; worker_count > 0 && i < queue.slot_count; i++) platSemaphorePost(queue.work);
+
+    for (int32_t index = 0; index < queue.band_count; index++) {
+        /* Without workers this thread formats every band itself */
+        if (worker_count == 0) format_queued_band(&queue, index);
+
+        jsExportSlot* slot = &slots[index % queue.slot_count];
+        platSemaphoreWait(slot->done);
+
+        jsWriter* writer = &slot->band.writer;
+        if (writer->failed) {
+            fprintf(stderr, "Export band %d failed, output is incomplete\n", index);
+            result->failed = true;
+        }
+        else {
+            size_t written = fwrite(writer->buffer, 1, writer->pos, fd);
+            if (written != writer->pos) {
+                if (!result->failed) fprintf(stderr, "Failed to write export data\n");
+                result->failed = true;
+            }
+            result->bytes_written += written;
+        }
+        /* The slot is free again, so the band after it in the slot can be taken */
+        if (worker_count > 0 && index + queue.slot_count < queue.band_count) platSemaphorePost(queue.work);
+    }
+
+    /* Every band is handed out, wake the workers so they see that and stop */
+    for (int32_t i = 0; i < worker_count; i++) platSemaphorePost(queue.work);
+    for (int32_t i = 0; i < worker_count; i++) platThreadJoin(threads[i]);
+    for (int32_t i = 0; i < queue.slot_count; i++) destroy_export_slot(&slots[i]);
+    platSemaphoreDestroy(queue.work);
+}
+
+jsExportResult js_export_canvas(const Canvas* canvas, FILE* fd, const char* name_x, const char* name_y, const jsExportOptions* options) {
+    jsExportResult result = {0};
+    jsExport export = { canvas, options, name_x, name_y, NULL };
+
+    jsRect* rects = NULL;
+    int32_t count = canvas->height;
+    if (options->merge_rects) {
+        rects = mesh_image_rects(canvas, options->ignore_color);
+        if (!rects) {
+            result.failed = true;
+            return result;
+        }
+        count = darrayLength(rects);
+    }
+
+    jsPalette palette = {0};
+    if (options->palette || options->compress) {
+        if (!palette_init(&palette) || !build_palette(&palette, canvas, rects, count, options->ignore_color)) {
+            fprintf(stderr, "Failed to allocate export palette\n");
+            palette_destroy(&palette);
+            if (rects) darrayDestroy(rects);
+            result.failed = true;
+            return result;
+        }
+        export.palette = &palette;
+    }
+
+    int32_t thread_count = options->threads > 0 ? options->threads : (int32_t)platGetCoreCount();
+    thread_count = MAX(1, MIN(thread_count, JS_EXPORT_MAX_THREADS));
+    if (thread_count > count) thread_count = count > 0 ? count : 1;
+    result.thread_count = thread_count;
+
+    if (options->compress) {
+        result = export_blob(&export, fd, rects, count);
+    }
+    else if (thread_count > 1) {
+        /* Header and footer of the palette go around the bands */
+        jsWriter writer = {0};
+        if (export.palette && !js_writer_init(&writer, fd, JS_WRITER_PALETTE_BUFFER_SIZE)) {
+            result.failed = true;
+        }
+        else {
+            if (export.palette) {
+                put_palette_header(&export, &writer);
+                js_writer_flush(&writer);
+            }
+
+            export_bands_threaded(&export, fd, rects, count, thread_count, &result);
+
+            if (export.palette) {
+                put_palette_footer(&writer);
+                js_writer_destroy(&writer);
+                result.bytes_written += writer.bytes_written;
+                if (writer.failed) result.failed = true;
+            }
+        }
+    }
+    else {
+        jsExportBand band = {
+            .export = &export,
+            .rects = rects,
+            .begin = 0,
+            .end = count,
+        };
+        if (js_writer_init(&band.writer, fd, JS_WRITER_BUFFER_SIZE)) {
+            if (export.palette) put_palette_header(&export, &band.writer);
+            export_band(&band);
+            if (export.palette) put_palette_footer(&band.writer);
+            js_writer_destroy(&band.writer);
+            result.bytes_written = band.writer.bytes_written;
+            result.failed = band.writer.failed;
+        }
+        else {
+            result.failed = true;
+        }
+    }
+
+    if (export.palette) palette_destroy(&palette);
+    if (rects) darrayDestroy(rects);
+    return result;
+}
+
+#define JS_READ_CHUNK_SIZE MiB(1)
+
+static inline int32_t hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static inline const char* skip_spaces(const char* curr, const char* end) {
+    while (curr < end && (*curr == ' ' || *curr == '\t' || *curr == '\r')) curr++;
+    return curr;
+}
+
+/* Skips a javascript variable name, numbers cant start one */
+static inline const char* skip_identifier(const char* curr, const char* end) {
+    if (curr >= end || !(isalpha((unsigned char)*curr) || *curr == '_' || *curr == '$')) return curr;
+    while (curr < end && (isalnum((unsigned char)*curr) || *curr == '_' || *curr == '$')) curr++;
+    return curr;
+}
+
+/* Parses [+-]digits[.digits] in place, no copy and no locale like atof */
+static bool parse_js_number(const char** cursor, const char* end, double* result) {
+    const char* curr = skip_spaces(*cursor, end);
+
+    bool negative = false;
+    if (curr < end && (*curr == '+' || *curr == '-')) {
+        negative = *curr == '-';
+        curr = skip_spaces(curr + 1, end);
+    }
+
+    uint64_t mantissa = 0;
+    int32_t digits = 0;
+    int32_t fraction_digits = 0;
+
+    while (curr < end && *curr >= '0' && *curr <= '9') {
+        if (digits < 18) mantissa = mantissa * 10 + (*curr - '0');
+        else fraction_digits--; /* Too many digits, keep the magnitude */
+        digits++;
+        curr++;
+    }
+
+    if (curr < end && *curr == '.') {
+        curr++;
+        while (curr < end && *curr >= '0' && *curr <= '9') {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (*curr - '0');
+                fraction_digits++;
+            }
+            digits++;
+            curr++;
+        }
+    }
+
+    if (digits == 0) return false;
+
+    double value = (double)mantissa;
+    static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+        1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+    if (fraction_digits > 0) value /= powers_of_ten[fraction_digits];
+    else if (fraction_digits < 0) value *= pow(10.0, -fraction_digits);
+
+    *result = negative ? -value : value;
+    *cursor = curr;
+    return true;
+}
+
+/* Skips the rest of an argument including the comma */
+static inline bool skip_argument(const char** cursor, const char* end) {
+    const char* comma = memchr(*cursor, ',', end - *cursor);
+    if (!comma) return false;
+    *cursor = comma + 1;
+    return true;
+}
+
+static const char* find_string(const char* begin, const char* end, const char* string) {
+    size_t length = strlen(string);
+    while (end - begin >= (ptrdiff_t)length) {
+        const char* first = memchr(begin, string[0], end - begin - length + 1);
+        if (!first) return NULL;
+        if (memcmp(first, string, length) == 0) return first;
+        begin = first + 1;
+    }
+    return NULL;
+}
+
+/* "#RRGGBB" to a packed color with alpha 255 */
+static bool parse_hex_color(const char* hashtag_pos, const char* end, uint32_t* packed) {
+    if (end - hashtag_pos < 7) return false;
+
+    uint8_t channels[4] = { 0, 0, 0, 255 };
+    for (int32_t i = 0; i < 3; i++) {
+        int32_t high = hex_digit_value(hashtag_pos[1 + i * 2]);
+        int32_t low = hex_digit_value(hashtag_pos[2 + i * 2]);
+        if (high < 0 || low < 0) return false;
+        channels[i] = (uint8_t)(high << 4 | low);
+    }
+
+    memcpy(packed, channels, sizeof(*packed));
+    return true;
+}
+
+/*
+   Parses "Canvas.rect(<name_x><x>, <name_y><y>, <w>, <h>, {fill:"#RRGGBB"})"
+   directly inside the read buffer. Returns false for lines that dont
+   contain a rect.
+*/
+bool parse_javascript_line(const char* begin, const char* end, jsLine* result) {
+    const char* curr = find_string(begin, end, "Canvas.rect(");
+    if (!curr) return false;
+    curr += strlen("Canvas.rect(");
+
+    curr = skip_identifier(skip_spaces(curr, end), end);
+    if (!parse_js_number(&curr, end, &result->offset_x)) return false;
+    if (!skip_argument(&curr, end)) return false;
+
+    curr = skip_identifier(skip_spaces(curr, end), end);
+    if (!parse_js_number(&curr, end, &result->offset_y)) return false;
+    if (!skip_argument(&curr, end)) return false;
+
+    if (!parse_js_number(&curr, end, &result->width)) return false;
+    if (!skip_argument(&curr, end)) return false;
+
+    if (!parse_js_number(&curr, end, &result->height)) return false;
+
+    const char* hashtag_pos = memchr(curr, '#', end - curr);
+    return hashtag_pos && parse_hex_color(hashtag_pos, end, &result->color);
+}
+
+/*
+   Streams the file through one fixed size buffer and calls func for every
+   line, so the memory use doesnt depend on the file size. A line that
+   doesnt fit into the buffer is skipped.
+*/
+bool read_javascript_lines(const char* path, PFN_onJsLine func, void* user_data) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "failed to open file: %s\n", path);
+        return false;
+    }
+
+    char* buffer = malloc(JS_READ_CHUNK_SIZE);
+    if (!buffer) {
+        fprintf(stderr, "failed to allocate read buffer\n");
+        fclose(file);
+        return false;
+    }
+
+    size_t length = 0;
+    bool skipping = false; /* Inside a line that was too long */
+
+    for (;;) {
+        size_t read = fread(&buffer[length], 1, JS_READ_CHUNK_SIZE - length, file);
+        length += read;
+        bool eof = read == 0;
+
+        const char* curr = buffer;
+        const char* end = buffer + length;
+
+        const char* newline;
+        while ((newline = memchr(curr, '\n', end - curr))) {
+            if (!skipping) func(curr, newline, user_data);
+            skipping = false;
+            curr = newline + 1;
+        }
+
+        if (eof) {
+            if (!skipping && curr < end) func(curr, end, user_data);
+            break;
+        }
+
+        /* Move the unfinished line to the front */
+        length = end - curr;
+        if (length == JS_READ_CHUNK_SIZE) {
+            if (!skipping) fprintf(stderr, "Skipping line longer than %d bytes\n", (int32_t)JS_READ_CHUNK_SIZE);
+            skipping = true;
+            length = 0;
+        }
+        else {
+            memmove(buffer, curr, length);
+        }
+    }
+
+    free(buffer);
+    fclose(file);
+    return true;
+}
+
+/*
+   Number of pixels a rect covers along one axis. The exporter adds half a
+   pixel of overlap to every rect (1.5 for a single pixel) so the size is
+   floored, rects from other tools with exact sizes work the same way.
+*/
+static inline int32_t js_size_to_pixels(double size) {
+    int32_t pixels = (int32_t)floor(size + 1e-4);
+    return pixels < 1 ? 1 : pixels;
+}
+
+typedef struct jsImport jsImport;
+typedef void (*PFN_onJsRect)(jsImport* import, const jsLine* line);
+
+/* Line state of one pass over a file, the palette formats need the lines before */
+struct jsImport {
+    PFN_onJsRect on_rect;
+    uint32_t* palette; /* darray of packed colors, NULL outside of a palette export */
+    bool blob; /* Inside a compressed export, the palette is set as well */
+    uint8_t* blob_data; /* Decoded base64 lines, inflated once the blob ends */
+    size_t blob_length;
+    size_t blob_capacity;
+    Canvas* canvas;
+    double max[2];
+};
+
+/* "<x2>,<y2>,<w>,<h>,<index>," in half pixels, see put_palette_header */
+static bool parse_palette_rect(const jsImport* import, const char* begin, const char* end, jsLine* result) {
+    double values[5];
+    const char* curr = begin;
+    for (int32_t i = 0; i < 5; i++) {
+        if (!parse_js_number(&curr, end, &values[i])) return false;
+        if (i < 4 && !skip_argument(&curr, end)) return false;
+    }
+
+    if (values[4] < 0.0 || values[4] >= (double)darrayLength(import->palette)) return false;
+
+    result->offset_x = values[0] * 0.5;
+    result->offset_y = values[1] * 0.5;
+    result->width = values[2];
+    result->height = values[3];
+    result->color = import->palette[(uint32_t)values[4]];
+    return true;
+}
+
+static inline int32_t base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+/* One "<base64>"+ line of the blob, curr is behind the opening quote */
+static bool append_blob_line(jsImport* import, const char* curr, const char* end) {
+    const char* quote = memchr(curr, '"', end - curr);
+    if (!quote || (quote - curr) % 4 != 0) return false;
+
+    size_t needed = import->blob_length + (quote - curr) / 4 * 3;
+    if (needed > import->blob_capacity) {
+        size_t capacity = MAX(needed, import->blob_capacity * 2);
+        uint8_t* data = realloc(import->blob_data, capacity);
+        if (!data) return false;
+        import->blob_data = data;
+        import->blob_capacity = capacity;
+    }
+
+    for (; curr < quote; curr += 4) {
+        int32_t values[4];
+        int32_t padding = 0;
+        for (int32_t i = 0; i < 4; i++) {
+            values[i] = curr[i] == '=' && i >= 2 ? 0 : base64_value(curr[i]);
+            if (values[i] < 0) return false;
+            if (curr[i] == '=') padding++;
+        }
+
+        uint32_t triple = (uint32_t)values[0] << 18 | (uint32_t)values[1] << 12 | (uint32_t)values[2] << 6 | (uint32_t)values[3];
+        uint8_t* out = &import->blob_data[import->blob_length];
+        out[0] = (uint8_t)(triple >> 16);
+        out[1] = (uint8_t)(triple >> 8);
+        out[2] = (uint8_t)triple;
+        import->blob_length += 3 - padding;
+    }
+    return true;
+}
+
+static inline bool read_varint(const uint8_t** cursor, const uint8_t* end, uint32_t* value) {
+    uint32_t result = 0;
+    for (int32_t shift = 0; shift < 35 && *cursor < end; shift += 7) {
+        uint8_t byte = *(*cursor)++;
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Inflates the blob and hands every tuple to on_rect, like the decoder in the page does */
+static void replay_blob(jsImport* import) {
+    int decoded_length = 0;
+    char* decoded = import->blob_length <= INT32_MAX
+        ? stbi_zlib_decode_malloc((const char*)import->blob_data, (int)import->blob_length, &decoded_length)
+        : NULL;
+    import->blob = false;
+    import->blob_length = 0;
+    if (!decoded) {
+        fprintf(stderr, "Failed to inflate the compressed export\n");
+        return;
+    }
+
+    const uint8_t* curr = (const uint8_t*)decoded;
+    const uint8_t* end = curr + decoded_length;
+    int32_t x2 = 0;
+    int32_t y2 = 0;
+    uint32_t palette_size = (uint32_t)darrayLength(import->palette);
+
+    while (curr < end) {
+        uint32_t values[5];
+        bool ok = true;
+        for (int32_t i = 0; i < 5 && ok; i++) ok = read_varint(&curr, end, &values[i]);
+        if (!ok || values[4] >= palette_size) break;
+
+        /* Zigzag deltas, see put_js_rect */
+        x2 += (int32_t)(values[0] >> 1) ^ -(int32_t)(values[0] & 1);
+        y2 += (int32_t)(values[1] >> 1) ^ -(int32_t)(values[1] & 1);
+
+        jsLine line = {
+            .offset_x = x2 * 0.5,
+            .offset_y = y2 * 0.5,
+            .width = values[2],
+            .height = values[3],
+            .color = import->palette[values[4]],
+        };
+        import->on_rect(import, &line);
+    }
+    free(decoded);
+}
+
+/* Canvas.rect lines, and the palette exports once their header was seen */
+static bool parse_import_line(jsImport* import, const char* begin, const char* end, jsLine* result) {
+    if (import->palette) {
+        const char* curr = skip_spaces(begin, end);
+        if (!import->blob && curr < end && (*curr == '-' || (*curr >= '0' && *curr <= '9'))) {
+            return parse_palette_rect(import, curr, end, result);
+        }
+
+        uint32_t color;
+        if (curr + 1 < end && curr[0] == '"' && curr[1] == '#' && parse_hex_color(curr + 1, end, &color)) {
+            darrayPush(import->palette, color);
+            return false;
+        }
+
+        if (import->blob && curr + 1 < end && curr[0] == '"') {
+            if (curr[1] == '"') replay_blob(import);
+            else if (!append_blob_line(import, curr + 1, end)) {
+                fprintf(stderr, "Broken line in the compressed export\n");
+                import->blob = false;
+                import->blob_length = 0;
+            }
+            return false;
+        }
+    }
+
+    bool blob = find_string(begin, end, JS_BLOB_HEADER) != NULL;
+    if (blob || find_string(begin, end, JS_PALETTE_HEADER)) {
+        if (import->palette) darrayClear(import->palette);
+        else import->palette = darrayCreate(uint32_t);
+        import->blob = blob;
+        import->blob_length = 0;
+        return false;
+    }
+
+    return parse_javascript_line(begin, end, result);
+}
+
+static void import_line(const char* begin, const char* end, void* user_data) {
+    jsImport* import = (jsImport*)user_data;
+    jsLine line;
+    if (parse_import_line(import, begin, end, &line)) import->on_rect(import, &line);
+}
+
+static bool read_import_lines(const char* path, jsImport* import) {
+    bool ok = read_javascript_lines(path, import_line, import);
+    if (import->palette) darrayDestroy(import->palette);
+    free(import->blob_data);
+    import->palette = NULL;
+    import->blob_data = NULL;
+    return ok;
+}
+
+static void extend_image_dim_from_js_rect(jsImport* import, const jsLine* line) {
+    double* max = import->max;
+
+    /* Offsets are rect centers so half of the rest of the rect is added */
+    double extent_x = fabs(line->offset_x) + (js_size_to_pixels(line->width) - 1) * 0.5;
+    double extent_y = fabs(line->offset_y) + (js_size_to_pixels(line->height) - 1) * 0.5;
+
+    if (extent_x > max[0]) max[0] = extent_x;
+    if (extent_y > max[1]) max[1] = extent_y;
+}
+
+bool get_image_dim_from_js(const char* path, int32_t* width, int32_t* height) {
+    jsImport import = { .on_rect = extend_image_dim_from_js_rect };
+    if (!read_import_lines(path, &import)) {
+        *width = *height = 0;
+        return false;
+    }
+
+    double max_x = ceilf(import.max[0]);
+    double max_y = ceilf(import.max[1]);
+    *width = max_x * 2;
+    *height = max_y * 2;
+    return *width > 0 && *height > 0;
+}
+
+/* Image column of a javascript x offset, js x runs the other way */
+static inline int32_t js_offset_to_img_x(const Canvas* canvas, double offset_x) {
+    int32_t offset = canvas->width % 2 == 0 ? 1 : 0;
+    return (int32_t)floorf(canvas->width * 0.5f - (float)offset_x) - offset;
+}
+
+static inline int32_t js_offset_to_img_y(const Canvas* canvas, double offset_y) {
+    return (int32_t)floorf(canvas->height * 0.5f - (float)offset_y);
+}
+
+void write_data_to_img(Canvas* canvas, const jsLine* data) {
+    double half_w = (js_size_to_pixels(data->width) - 1) * 0.5;
+    double half_h = (js_size_to_pixels(data->height) - 1) * 0.5;
+
+    int32_t x0 = js_offset_to_img_x(canvas, data->offset_x + half_w);
+    int32_t x1 = js_offset_to_img_x(canvas, data->offset_x - half_w);
+    int32_t y0 = js_offset_to_img_y(canvas, data->offset_y + half_h);
+    int32_t y1 = js_offset_to_img_y(canvas, data->offset_y - half_h);
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= canvas->width) x1 = canvas->width - 1;
+    if (y1 >= canvas->height) y1 = canvas->height - 1;
+    if (x0 > x1 || y0 > y1) return;
+
+    canvas_fill_rect(canvas, x0, y0, x1 - x0 + 1, y1 - y0 + 1, data->color);
+}
+
+static void write_js_rect_to_img(jsImport* import, const jsLine* line) {
+    write_data_to_img(import->canvas, line);
+}
+
+bool js_import_canvas(Canvas* canvas, const char* path) {
+    jsImport import = { .on_rect = write_js_rect_to_img, .canvas = canvas };
+    return read_import_lines(path, &import);
+}
@@ -0,0 +1,57 @@
+#ifndef JAVASCRIPT_H
+#define JAVASCRIPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "canvas.h"
+
+#define JS_EXPORT_MAX_THREADS 64
+
+/*
+   Canvas to Canvas.rect javascript export. Only needs the canvas, so it is
+   shared by the editor and the headless command line tools.
+*/
+typedef struct jsExportOptions {
+    uint32_t ignore_color; /* Packed like the canvas pixels */
+    float scale;
+    bool x_mirrored;
+    bool merge_rects;
+    bool palette; /* Colors once in a palette array, then packed (x, y, w, h, index) tuples */
+    bool compress; /* Palette tuples as a deflated base64 blob the page inflates itself, implies palette */
+    int32_t threads; /* 0 means one per core */
+} jsExportOptions;
+
+typedef struct jsExportResult {
+    uint64_t bytes_written;
+    int32_t thread_count;
+    bool failed;
+} jsExportResult;
+
+jsExportResult js_export_canvas(const Canvas* canvas, FILE* fd, const char* name_x, const char* name_y, const jsExportOptions* options);
+
+/* One Canvas.rect call of an export, offsets are rect centers */
+typedef struct jsLine {
+    double offset_x;
+    double offset_y;
+    double width;
+    double height;
+    uint32_t color; /* Packed like the canvas pixels, alpha is always 255 */
+} jsLine;
+
+typedef void (*PFN_onJsLine)(const char* begin, const char* end, void* user_data);
+
+bool parse_javascript_line(const char* begin, const char* end, jsLine* result);
+bool read_javascript_lines(const char* path, PFN_onJsLine func, void* user_data);
+
+/* First pass over the file, only looks at the rect extents. False if there is no rect */
+bool get_image_dim_from_js(const char* path, int32_t* width, int32_t* height);
+
+/* Fills every pixel the rect covers, clipped to the canvas */
+void write_data_to_img(Canvas* canvas, const jsLine* data);
+
+/* Second pass, paints every rect as soon as its line is parsed */
+bool js_import_canvas(Canvas* canvas, const char* path);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+   Headless javascript to image converter, turns Canvas.rect exports back
+   into pngs. Uses the same import as the editor but never opens a window.
+
+   js2png [options] <file or directory>...
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <dirent.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#define STB_IMAGE_IMPLEMENTATION /* zlib for the compressed export */
+#include "stb_image.h"
+
+#include "arena_allocator.h"
+#include "darray.h"
+#include "platform.h"
+#include "canvas.h"
+#include "javascript.h"
+
+#define JS2PNG_MAX_THREADS 64
+#define JS2PNG_PATH_SIZE 4096
+
+typedef struct Js2pngArgs {
+    const char* out_dir; /* NULL writes next to the javascript file */
+    int32_t threads; /* Files converted at the same time, 0 means one per core */
+
+    char** files; /* darray, every path is malloced */
+} Js2pngArgs;
+
+typedef struct Js2pngJobs {
+    const Js2pngArgs* args;
+    int32_t file_count;
+    _Atomic int32_t next;
+    _Atomic int32_t failed;
+    _Atomic uint64_t pixels_written;
+} Js2pngJobs;
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "usage: js2png [options] <file or directory>...\n"
+        "  -o <dir>        write the pngs into dir instead of next to the javascript files\n"
+        "  -j <threads>    files converted in parallel (default one per core)\n"
+        "Directories are searched for .js and .txt files, not recursively.\n");
+}
+
+static void push_file(Js2pngArgs* args, const char* path) {
+    size_t size = strlen(path) + 1;
+    char* copy = malloc(size);
+    if (!copy) return;
+    memcpy(copy, path, size);
+    darrayPush(args->files, copy);
+}
+
+static bool has_javascript_extension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    return dot && (strcmp(dot, ".js") == 0 || strcmp(dot, ".txt") == 0);
+}
+
+/* Adds the file itself, or every javascript file inside of it if it is a directory */
+static void push_path(Js2pngArgs* args, const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        push_file(args, path);
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (!has_javascript_extension(entry->d_name)) continue;
+
+        char file[JS2PNG_PATH_SIZE];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        push_file(args, file);
+    }
+    closedir(dir);
+}
+
+static bool parse_args(int argc, char** argv, Js2pngArgs* args) {
+    *args = (Js2pngArgs){ .files = darrayCreate(char*) };
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            push_path(args, arg);
+            continue;
+        }
+
+        if (arg[2] != '\0' || i + 1 >= argc) {
+            fprintf(stderr, "Unknown option or missing value: %s\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+
+        switch (arg[1]) {
+            case 'o': args->out_dir = value; break;
+            case 'j': args->threads = atoi(value); break;
+            default:
+                fprintf(stderr, "Unknown option: %s\n", arg);
+                return false;
+        }
+    }
+
+    return darrayLength(args->files) > 0;
+}
+
+/* <out_dir>/<name>.png, or the javascript path with its extension swapped */
+static void get_output_path(const Js2pngArgs* args, const char* js, char* out, size_t size) {
+    const char* name = js;
+    for (const char* c = js; *c; c++) {
+        if (*c == '/' || *c == '\\') name = c + 1;
+    }
+    const char* dot = strrchr(name, '.');
+    int32_t base_length = dot ? (int32_t)(dot - name) : (int32_t)strlen(name);
+
+    if (args->out_dir) {
+        snprintf(out, size, "%s/%.*s.png", args->out_dir, base_length, name);
+    }
+    else {
+        int32_t dir_length = (int32_t)(name - js);
+        snprintf(out, size, "%.*s%.*s.png", dir_length, js, base_length, name);
+    }
+}
+
+static bool convert_file(Js2pngJobs* jobs, const char* js) {
+    int32_t width, height;
+    if (!get_image_dim_from_js(js, &width, &height)) {
+        fprintf(stderr, "%s: no Canvas.rect found\n", js);
+        return false;
+    }
+
+    /* Black background like a canvas the editor imports into */
+    uint8_t black[4] = { 0, 0, 0, 255 };
+    uint32_t background;
+    memcpy(&background, black, sizeof(background));
+
+    Canvas canvas;
+    if (!canvas_create(&canvas, width, height, background)) {
+        fprintf(stderr, "%s: failed to create %dx%d canvas\n", js, width, height);
+        return false;
+    }
+
+    bool ok = js_import_canvas(&canvas, js);
+
+    /* stbi wants one flat image */
+    uint32_t* pixels = ok ? malloc((size_t)width * height * 4) : NULL;
+    if (pixels) canvas_read_rect(&canvas, 0, 0, width, height, pixels, width);
+    canvas_destroy(&canvas);
+    if (!pixels) {
+        if (ok) fprintf(stderr, "%s: failed to allocate %dx%d image\n", js, width, height);
+        return false;
+    }
+
+    char path[JS2PNG_PATH_SIZE];
+    get_output_path(jobs->args, js, path, sizeof(path));
+    ok = stbi_write_png(path, width, height, 4, pixels, width * 4);
+    free(pixels);
+
+    if (!ok) {
+        fprintf(stderr, "%s: failed to write %s\n", js, path);
+        return false;
+    }
+
+    atomic_fetch_add(&jobs->pixels_written, (uint64_t)width * height);
+    return true;
+}
+
+static void run_jobs(void* user_data) {
+    Js2pngJobs* jobs = user_data;
+
+    for (;;) {
+        int32_t index = atomic_fetch_add(&jobs->next, 1);
+        if (index >= jobs->file_count) break;
+        if (!convert_file(jobs, jobs->args->files[index])) atomic_fetch_add(&jobs->failed, 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    Js2pngArgs args;
+    if (!parse_args(argc, argv, &args)) {
+        print_usage();
+        return 1;
+    }
+
+    double start = platGetTime();
+
+    Js2pngJobs jobs = { .args = &args, .file_count = (int32_t)darrayLength(args.files) };
+
+    int32_t thread_count = args.threads > 0 ? args.threads : (int32_t)platGetCoreCount();
+    thread_count = MAX(1, MIN(MIN(thread_count, JS2PNG_MAX_THREADS), jobs.file_count));
+
+    PlatThread* threads[JS2PNG_MAX_THREADS] = {0};
+    for (int32_t i = 1; i < thread_count; i++) threads[i] = platThreadCreate(run_jobs, &jobs);
+    run_jobs(&jobs);
+    for (int32_t i = 1; i < thread_count; i++) {
+        if (threads[i]) platThreadJoin(threads[i]);
+    }
+
+    int32_t failed = atomic_load(&jobs.failed);
+    printf("Converted %d of %d files, %.2f MPixels in %.3fs with %d threads\n",
+            jobs.file_count - failed, jobs.file_count,
+            atomic_load(&jobs.pixels_written) / 1e6, platGetTime() - start, thread_count);
+
+    for (int32_t i = 0; i < jobs.file_count; i++) free(args.files[i]);
+    darrayDestroy(args.files);
+    return failed > 0 ? 1 : 0;
+}
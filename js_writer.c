@@ -0,0 +1,215 @@
+
+#include "js_writer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool js_writer_init(jsWriter* writer, FILE* file, size_t capacity) {
+    writer->arena = NULL;
+    writer->file = file;
+    writer->pos = 0;
+    writer->failed = false;
+    writer->capacity = capacity;
+    writer->bytes_written = 0;
+    writer->buffer = malloc(capacity);
+    if (!writer->buffer) {
+        fprintf(stderr, "Failed to allocate export buffer\n");
+        return false;
+    }
+    return true;
+}
+
+bool js_writer_init_arena(jsWriter* writer, MemArena* arena) {
+    writer->arena = arena;
+    writer->file = NULL;
+    writer->pos = 0;
+    writer->failed = false;
+    writer->capacity = JS_WRITER_ARENA_GROW_SIZE;
+    writer->bytes_written = 0;
+    writer->buffer = arenaPush(arena, JS_WRITER_ARENA_GROW_SIZE, true);
+    if (!writer->buffer) {
+        fprintf(stderr, "Failed to allocate export buffer in arena\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+   The writer owns the top of the arena, so pushing more memory extends the
+   buffer in place without copying anything
+*/
+static void js_writer_grow(jsWriter* writer, size_t length) {
+    if (writer->failed) {
+        writer->pos = 0;
+        return;
+    }
+
+    u64 grow = ALIGN_UP_POW2(MAX(length, JS_WRITER_ARENA_GROW_SIZE), ARENA_ALIGN);
+    if (!arenaPush(writer->arena, grow, true)) {
+        /* Keep going in the buffer we have, the result is thrown away anyway */
+        fprintf(stderr, "Export arena is full, dropping output\n");
+        writer->failed = true;
+        writer->pos = 0;
+        return;
+    }
+    writer->capacity += grow;
+}
+
+void js_writer_flush(jsWriter* writer) {
+    if (writer->pos == 0 || writer->arena) return;
+
+    size_t written = fwrite(writer->buffer, 1, writer->pos, writer->file);
+    if (written != writer->pos) {
+        if (!writer->failed) fprintf(stderr, "Failed to write export data\n");
+        writer->failed = true;
+    }
+    writer->bytes_written += written;
+    writer->pos = 0;
+}
+
+void js_writer_destroy(jsWriter* writer) {
+    js_writer_flush(writer);
+    if (!writer->arena) free(writer->buffer);
+    writer->buffer = NULL;
+}
+
+static inline void js_writer_reserve(jsWriter* writer, size_t length) {
+    if (writer->pos + length <= writer->capacity) return;
+
+    if (writer->arena) js_writer_grow(writer, length);
+    else js_writer_flush(writer);
+}
+
+void js_writer_put_string(jsWriter* writer, const char* string, size_t length) {
+    js_writer_reserve(writer, length);
+
+    /* Doesnt fit even in an empty buffer so write it directly */
+    if (writer->pos + length > writer->capacity) {
+        if (writer->file) {
+            size_t written = fwrite(string, 1, length, writer->file);
+            if (written != length) {
+                if (!writer->failed) fprintf(stderr, "Failed to write export data\n");
+                writer->failed = true;
+            }
+            writer->bytes_written += written;
+        }
+        return;
+    }
+
+    memcpy(&writer->buffer[writer->pos], string, length);
+    writer->pos += length;
+}
+
+void js_writer_put_fixed2(jsWriter* writer, float value, bool force_sign) {
+    js_writer_reserve(writer, JS_WRITER_MAX_FIXED2);
+
+    /*
+       A float has 24 bits of mantissa so multiplying it by 100 in double
+       precision is exact. nearbyint then rounds ties to even just like printf
+       does with the exact binary value.
+    */
+    double scaled = (double)value * 100.0;
+    if (!(fabs(scaled) < 1e15)) {
+        char tmp[64];
+        int32_t length = snprintf(tmp, sizeof(tmp), force_sign ? "%+.2f" : "%.2f", value);
+        js_writer_put_string(writer, tmp, length);
+        return;
+    }
+
+    uint64_t rounded = (uint64_t)nearbyint(fabs(scaled));
+    char* out = &writer->buffer[writer->pos];
+
+    if (signbit(value)) *out++ = '-';
+    else if (force_sign) *out++ = '+';
+
+    uint64_t integer = rounded / 100;
+    uint32_t fraction = (uint32_t)(rounded % 100);
+
+    char digits[20];
+    int32_t count = 0;
+    do {
+        digits[count++] = '0' + (char)(integer % 10);
+        integer /= 10;
+    } while (integer);
+
+    while (count) *out++ = digits[--count];
+
+    *out++ = '.';
+    *out++ = '0' + (char)(fraction / 10);
+    *out++ = '0' + (char)(fraction % 10);
+
+    writer->pos = out - writer->buffer;
+}
+
+void js_writer_put_hex6(jsWriter* writer, uint32_t value) {
+    static const char hex[] = "0123456789ABCDEF";
+
+    js_writer_reserve(writer, 6);
+    char* out = &writer->buffer[writer->pos];
+    for (int32_t i = 5; i >= 0; i--) {
+        out[i] = hex[value & 0xF];
+        value >>= 4;
+    }
+    writer->pos += 6;
+}
+
+void js_writer_put_int(jsWriter* writer, int32_t value) {
+    js_writer_reserve(writer, 11);
+    char* out = &writer->buffer[writer->pos];
+
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    if (value < 0) *out++ = '-';
+
+    char digits[10];
+    int32_t count = 0;
+    do {
+        digits[count++] = '0' + (char)(magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+
+    while (count) *out++ = digits[--count];
+    writer->pos = out - writer->buffer;
+}
+
+void js_writer_put_rect(jsWriter* writer, const char* name_x, const char* name_y,
+                        float x, float y, float w, float h, uint32_t color) {
+    JS_WRITER_PUT_LITERAL(writer, "Canvas.rect(");
+    js_writer_put_string(writer, name_x, strlen(name_x));
+    js_writer_put_fixed2(writer, x, true);
+    JS_WRITER_PUT_LITERAL(writer, ", ");
+    js_writer_put_string(writer, name_y, strlen(name_y));
+    js_writer_put_fixed2(writer, y, true);
+    JS_WRITER_PUT_LITERAL(writer, ", ");
+    js_writer_put_fixed2(writer, w, false);
+    JS_WRITER_PUT_LITERAL(writer, ", ");
+    js_writer_put_fixed2(writer, h, false);
+    JS_WRITER_PUT_LITERAL(writer, ", {fill:\"#");
+    js_writer_put_hex6(writer, color);
+    JS_WRITER_PUT_LITERAL(writer, "\"}),\n");
+}
+
+void js_writer_put_palette_rect(jsWriter* writer, int32_t x2, int32_t y2, int32_t w, int32_t h, uint32_t index) {
+    js_writer_put_int(writer, x2);
+    JS_WRITER_PUT_LITERAL(writer, ",");
+    js_writer_put_int(writer, y2);
+    JS_WRITER_PUT_LITERAL(writer, ",");
+    js_writer_put_int(writer, w);
+    JS_WRITER_PUT_LITERAL(writer, ",");
+    js_writer_put_int(writer, h);
+    JS_WRITER_PUT_LITERAL(writer, ",");
+    js_writer_put_int(writer, (int32_t)index);
+    JS_WRITER_PUT_LITERAL(writer, ",\n");
+}
+
+void js_writer_put_varint(jsWriter* writer, uint32_t value) {
+    js_writer_reserve(writer, 5);
+    uint8_t* out = (uint8_t*)&writer->buffer[writer->pos];
+
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    writer->pos = (char*)out - writer->buffer;
+}
@@ -0,0 +1,65 @@
+
+#ifndef JS_WRITER_H
+#define JS_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "arena_allocator.h"
+
+#define JS_WRITER_BUFFER_SIZE MiB(4)
+#define JS_WRITER_ARENA_GROW_SIZE KiB(64)
+
+/* Longest number js_writer_put_fixed2 writes without falling back to snprintf */
+#define JS_WRITER_MAX_FIXED2 24
+
+/*
+   Buffered writer for the javascript export. Replaces the per pixel fprintf,
+   numbers and colors are formatted by hand into one big buffer which gets
+   written out in large chunks. The output is byte for byte the same as the
+   old "%+.2f" / "%.2f" / "#%06X" format strings.
+   A writer created with js_writer_init_arena never flushes, its buffer grows
+   at the top of the arena instead (used for the threaded export bands).
+*/
+typedef struct jsWriter {
+    FILE* file;
+    MemArena* arena;
+    char* buffer;
+    size_t pos;
+    size_t capacity;
+    uint64_t bytes_written;
+    bool failed;
+} jsWriter;
+
+bool js_writer_init(jsWriter* writer, FILE* file, size_t capacity);
+bool js_writer_init_arena(jsWriter* writer, MemArena* arena);
+void js_writer_flush(jsWriter* writer);
+void js_writer_destroy(jsWriter* writer); /* Flushes before freeing */
+
+void js_writer_put_string(jsWriter* writer, const char* string, size_t length);
+
+#define JS_WRITER_PUT_LITERAL(writer, literal) \
+    js_writer_put_string((writer), (literal), sizeof(literal) - 1)
+
+/* Same text as printf("%d") */
+void js_writer_put_int(jsWriter* writer, int32_t value);
+
+/* Same text as printf("%+.2f") if force_sign else printf("%.2f") */
+void js_writer_put_fixed2(jsWriter* writer, float value, bool force_sign);
+
+/* Same text as printf("%06X") for colors that fit into 24 bits */
+void js_writer_put_hex6(jsWriter* writer, uint32_t value);
+
+/* Canvas.rect(<name_x><x>, <name_y><y>, <w>, <h>, {fill:"#<color>"}),\n */
+void js_writer_put_rect(jsWriter* writer, const char* name_x, const char* name_y,
+                        float x, float y, float w, float h, uint32_t color);
+
+/* <x2>,<y2>,<w>,<h>,<index>,\n one tuple of the palette export data array */
+void js_writer_put_palette_rect(jsWriter* writer, int32_t x2, int32_t y2, int32_t w, int32_t h, uint32_t index);
+
+/* 7 bits per byte, low bits first, high bit set on all but the last byte. Binary, for the blob export */
+void js_writer_put_varint(jsWriter* writer, uint32_t value);
+
+#endif
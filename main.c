@@ -2,6 +2,7 @@
 #include <dirent.h>
 #include <iso646.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <raylib.h>
 #include <raymath.h>
@@ -15,249 +16,374 @@
 
 #include "common.h"
 #include "arena_allocator.h"
+#include "platform.h"
+#include "js_writer.h"
+#include "javascript.h"
+#include "history.h"
+#include "input.h"
+#include "raster.h"
+#include "profiler.h"
 
 #include "ui.c"
 
 #define COLOR_PICKER_RESOLUTION 400
+#define PROFILER_OVERLAY_FRAMES 120 /* Frames the breakdown averages over */
 
-#define MAX_JAVASCRIPT_LINE 256
+bool load_javascript_file(Context* ctx, const char* path) {
+    int32_t width, height;
+    if (!get_image_dim_from_js(path, &width, &height)) {
+        fprintf(stderr, "No Canvas.rect found in: %s\n", path);
+        return false;
+    }
 
-typedef struct jsLine {
-    double offset_x;
-    double offset_y;
-    Color color;
-} jsLine; 
+    if (!create_canvas(ctx, width, height, NULL)) return false;
 
-static inline uint8_t hex2_to_u8(char* hex) {
-    char buffer[3];
-    buffer[0] = hex[0];
-    buffer[1] = hex[1];
-    buffer[2] = '\0';
-    return strtol(buffer, NULL, 16);
-}
+    /* Pages are still stale, they get uploaded once they are drawn */
+    bool ok = js_import_canvas(&ctx->canvas, path);
 
-/* Without errro checking and documentation xD */
-static void parse_javascript_line(Context* ctx, char* line, int32_t line_index, jsLine** lines) {
-    char* open_paren = strchr(line, '(');
-    char* comma_pos_x = strchr(line, ',');
-    char* plus_sign_x = strchr(line, '+');
-    char* minus_sign_x = strchr(line, '-');
+    /* Otherwise the first save state would think the import was part of it */
+    canvas_checkpoint(&ctx->canvas);
+    return ok;
+}
 
-    bool plus_sign = false;
-    if (plus_sign_x && plus_sign_x < comma_pos_x) plus_sign = true;
+void load_from_javascript(Context* ctx) {
+    const char* filters[] = { "*.txt", "*.js" };
+    const char* path = tinyfd_openFileDialog(
+            "Open Image",
+            "",
+            ARRAY_LEN(filters),
+            filters,
+            "Text or Js Files",
+            0);
+    if (!path) {
+        fprintf(stderr, "Failed to get path!\n");
+        return;
+    }
 
-    char* sign_pos = plus_sign ? plus_sign_x : minus_sign_x;
+    load_javascript_file(ctx, path);
+}
 
-    char* var_name_x = open_paren + 1;
-    size_t var_name_x_len = sign_pos - var_name_x;
+static inline bool compare_colors(Color a, Color b) {
+    return (a.r == b.r &&
+            a.g == b.g &&
+            a.b == b.b &&
+            a.a == b.a);
+}
 
-    size_t offset_x_digits = comma_pos_x - sign_pos;
-    char offset_x_str[offset_x_digits + 1];
-    memcpy(offset_x_str, sign_pos, offset_x_digits);
-    offset_x_str[offset_x_digits] = '\0';
+static inline Color unpack_color(uint32_t packed) {
+    Color c;
+    memcpy(&c, &packed, sizeof(c));
+    return c;
+}
 
-    double offset_x = atof(offset_x_str);
+static inline uint32_t pack_color(Color c) {
+    uint32_t packed;
+    memcpy(&packed, &c, sizeof(packed));
+    return packed;
+}
 
-    char* plus_sign_y = strchr(comma_pos_x, '+');
-    char* minus_sign_y = strchr(comma_pos_x, '-');
+/* Index is the byte offset the pixel would have in a flat RGBA image */
+static inline Color get_color_from_index(Context* ctx, int32_t index) {
+    if (index < 0) return BLANK;
+    int32_t pixel = index / 4;
+    return unpack_color(canvas_get(&ctx->canvas, pixel % ctx->new_image_width, pixel / ctx->new_image_width));
+}
 
-    plus_sign = false;
-    if (plus_sign_y) plus_sign = true;
+static inline void mark_dirty(Context* ctx, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
+    DirtyRect* d = &ctx->dirty;
+    if (!d->valid) {
+        *d = (DirtyRect){ true, min_x, min_y, max_x, max_y };
+        return;
+    }
+    if (min_x < d->min_x) d->min_x = min_x;
+    if (min_y < d->min_y) d->min_y = min_y;
+    if (max_x > d->max_x) d->max_x = max_x;
+    if (max_y > d->max_y) d->max_y = max_y;
+}
 
-    sign_pos = plus_sign ? plus_sign_y : minus_sign_y;
+/* The canvas belongs to the raster worker, the main thread locks it to read */
+static inline void lock_canvas(Context* ctx) {
+    if (ctx->raster) raster_worker_lock(ctx->raster);
+}
 
-    char* var_name_y = comma_pos_x + 2;
-    size_t var_name_y_len = sign_pos - var_name_y;
+static inline void unlock_canvas(Context* ctx) {
+    if (ctx->raster) raster_worker_unlock(ctx->raster);
+}
 
-    char* comma_pos_y = strchr(comma_pos_x + 1, ',');
+/* After this the main thread has the canvas to itself until it posts something */
+static inline void wait_for_raster(Context* ctx) {
+    if (ctx->raster) raster_worker_wait(ctx->raster);
+}
 
-    size_t offset_y_digits = comma_pos_y - sign_pos;
-    char offset_y_str[offset_y_digits + 1];
-    memcpy(offset_y_str, sign_pos, offset_y_digits);
-    offset_y_str[offset_y_digits] = '\0';
+static uint8_t* get_upload_buffer(Context* ctx, size_t size) {
+    if (size > ctx->upload_buffer_size) {
+        uint8_t* buffer = realloc(ctx->upload_buffer, size);
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate upload buffer\n");
+            return NULL;
+        }
+        ctx->upload_buffer = buffer;
+        ctx->upload_buffer_size = size;
+    }
+    return ctx->upload_buffer;
+}
 
-    double offset_y = atof(offset_y_str);
+static void pack_ignored_mask(Context* ctx, uint8_t* out, int32_t min_x, int32_t min_y, int32_t width, int32_t height) {
+    uint32_t ignore = pack_color(ctx->ignore_color);
 
-    /* Width is same as height so only width needed */
-    char* comma_width = strchr(comma_pos_y + 1, ',');
-    char* width_pos = comma_pos_y + 2;
+    for (int32_t y = 0; y < height; y++) {
+        uint8_t* dst = &out[(size_t)y * width * 2];
+        int32_t x = 0;
+        while (x < width) {
+            int32_t count;
+            uint32_t uniform;
+            const uint32_t* row = canvas_row_segment(&ctx->canvas, min_x + x, min_y + y, &count, &uniform);
+            count = MIN(count, width - x);
 
-    size_t width_digits = comma_width - width_pos;
-    char width_str[width_digits + 1];
-    memcpy(width_str, width_pos, width_digits);
-    width_str[width_digits] = '\0';
+            if (!row) {
+                memset(&dst[x * 2], uniform == ignore ? 255 : 0, (size_t)count * 2);
+            }
+            else {
+                for (int32_t i = 0; i < count; i++) {
+                    uint8_t value = row[i] == ignore ? 255 : 0;
+                    dst[(x + i) * 2 + 0] = value;
+                    dst[(x + i) * 2 + 1] = value;
+                }
+            }
+            x += count;
+        }
+    }
+}
 
-    double width = atof(width_str);
+static inline CanvasPage* get_page(Context* ctx, int32_t page_x, int32_t page_y) {
+    return &ctx->pages[page_y * ctx->pages_x + page_x];
+}
 
-    char* hashtag_pos = strchr(comma_width, '#');
-    char* curr_pos = hashtag_pos + 1;
-    
-    Color color = { .a = 255 };
-    color.r = hex2_to_u8(curr_pos);
-    curr_pos += 2;
-    color.g = hex2_to_u8(curr_pos);
-    curr_pos += 2;
-    color.b = hex2_to_u8(curr_pos);
-
-    /* Creation of Structure */
-    jsLine data = {
-        .offset_x = offset_x,
-        .offset_y = offset_y,
-        .color = color,
+/* Canvas pixels the page covers */
+static inline Rectangle get_page_rect(Context* ctx, int32_t page_x, int32_t page_y) {
+    int32_t x = page_x * CANVAS_PAGE_SIZE;
+    int32_t y = page_y * CANVAS_PAGE_SIZE;
+    return (Rectangle){
+        x, y,
+        MIN(CANVAS_PAGE_SIZE, ctx->new_image_width - x),
+        MIN(CANVAS_PAGE_SIZE, ctx->new_image_height - y),
     };
+}
 
-    darrayPush(*lines, data);
+static void unload_page_textures(CanvasPage* page) {
+    if (page->tex.id != 0) UnloadTexture(page->tex);
+    if (page->mask.id != 0) UnloadTexture(page->mask);
+    page->tex = (Texture2D){0};
+    page->mask = (Texture2D){0};
+    page->mask_valid = false;
 }
 
-static Vector2I get_image_dim_from_js(jsLine* array) {
-    double max_x = 0.0;
-    double max_y = 0.0;
-    for (int32_t i = 0; i < darrayLength(array); i++) {
-        jsLine* element = &array[i];
-        if (fabs(element->offset_x) > max_x) max_x = fabs(element->offset_x);
-        if (fabs(element->offset_y) > max_y) max_y = fabs(element->offset_y);
+/* A page is solid if all its tiles are uniform with the same color */
+static bool page_is_solid(Context* ctx, int32_t page_x, int32_t page_y, uint32_t* color) {
+    Canvas* canvas = &ctx->canvas;
+    int32_t tiles_per_page = CANVAS_PAGE_SIZE / CANVAS_TILE_SIZE;
+    int32_t tile_x0 = page_x * tiles_per_page;
+    int32_t tile_y0 = page_y * tiles_per_page;
+    int32_t tile_x1 = MIN(tile_x0 + tiles_per_page, canvas->tiles_x);
+    int32_t tile_y1 = MIN(tile_y0 + tiles_per_page, canvas->tiles_y);
+
+    *color = canvas->uniform[tile_y0 * canvas->tiles_x + tile_x0];
+    for (int32_t ty = tile_y0; ty < tile_y1; ty++) {
+        for (int32_t tx = tile_x0; tx < tile_x1; tx++) {
+            int32_t tile = ty * canvas->tiles_x + tx;
+            if (canvas->tiles[tile] || canvas->uniform[tile] != *color) return false;
+        }
     }
-
-    max_x = ceilf(max_x);
-    max_y = ceilf(max_y);
-    return (Vector2I){max_x * 2, max_y * 2 };
+    return true;
 }
 
-static void write_data_to_img(Context* ctx, jsLine* data)
-{
-    float center_x = ctx->new_image_width  * 0.5f;
-    float center_y = ctx->new_image_height * 0.5f;
-
-    int32_t offset = ctx->new_image_width % 2 == 0 ? 1 : 0;
-
-    for (int32_t i = 0; i < darrayLength(data); i++)
-    {
-        float px = center_x - (float)data[i].offset_x;
-        float py = center_y - (float)data[i].offset_y;
-
-        int32_t img_pos_x = (int32_t)floorf(px) - offset;
-        int32_t img_pos_y = (int32_t)floorf(py);
-
-
-        if (img_pos_x < 0 || img_pos_x >= ctx->new_image_width ||
-            img_pos_y < 0 || img_pos_y >= ctx->new_image_height)
-            continue;
-
-        int32_t index =
-            (img_pos_y * ctx->new_image_width + img_pos_x) * 4;
-
-        ctx->image_data[index + 0] = data[i].color.r;
-        ctx->image_data[index + 1] = data[i].color.g;
-        ctx->image_data[index + 2] = data[i].color.b;
-        ctx->image_data[index + 3] = 255;
+static void rebuild_page_mask(Context* ctx, CanvasPage* page, Rectangle rect) {
+    uint8_t* buffer = get_upload_buffer(ctx, (size_t)rect.width * rect.height * 2);
+    if (!buffer) return;
+    pack_ignored_mask(ctx, buffer, rect.x, rect.y, rect.width, rect.height);
+
+    if (page->mask.id == 0) {
+        Image img = {
+            .data = buffer,
+            .width = rect.width,
+            .height = rect.height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA,
+        };
+        page->mask = LoadTextureFromImage(img);
+        SetTextureFilter(page->mask, TEXTURE_FILTER_POINT);
+    }
+    else {
+        UpdateTexture(page->mask, buffer);
     }
+    page->mask_valid = true;
 }
 
+static void update_page_mask_region(Context* ctx, CanvasPage* page, Rectangle rect, int32_t min_x, int32_t min_y, int32_t width, int32_t height) {
+    if (!page->mask_valid) return;
 
-void load_from_javascript(Context* ctx) {
-    const char* filters[] = { "*.txt" };
-    const char* path = tinyfd_openFileDialog(
-            "Open Image",
-            "",
-            ARRAY_LEN(filters),
-            filters,
-            "Text Files",
-            0);
-    if (!path) {
-        fprintf(stderr, "Failed to get path!\n");
+    /* Not shown, so dont bother and rebuild once it gets turned on again */
+    if (!ctx->draw_ignored_pixels) {
+        page->mask_valid = false;
         return;
     }
 
-    FILE* file = fopen(path, "rb");
-    if (!file) {
-        fprintf(stderr, "failed to open file: %s\n", path);
+    uint8_t* buffer = get_upload_buffer(ctx, (size_t)width * height * 2);
+    if (!buffer) {
+        page->mask_valid = false;
         return;
     }
 
-    fseek(file, 0, SEEK_END);
-    int64_t size = ftell(file);
-    rewind(file);
+    pack_ignored_mask(ctx, buffer, min_x, min_y, width, height);
+    UpdateTextureRec(page->mask, (Rectangle){ min_x - rect.x, min_y - rect.y, width, height }, buffer);
+}
 
-    char buffer[size + 1];
-    fread(buffer, size, 1, file);
-    buffer[size] = '\0';
+/*
+   Brings the texture of a page up to date for the given region. Stale pages
+   and pages that just stopped being one color get uploaded as a whole.
+*/
+static void update_page(Context* ctx, int32_t page_x, int32_t page_y, int32_t min_x, int32_t min_y, int32_t width, int32_t height) {
+    CanvasPage* page = get_page(ctx, page_x, page_y);
+    Rectangle rect = get_page_rect(ctx, page_x, page_y);
+
+    page->solid = page_is_solid(ctx, page_x, page_y, &page->solid_color);
+    if (page->solid) {
+        unload_page_textures(page);
+        page->stale = false;
+        return;
+    }
 
-    char* delim = "\n";
-    char* token = strtok(buffer, delim);
+    bool whole = page->stale || page->tex.id == 0;
+    if (whole) {
+        min_x = rect.x;
+        min_y = rect.y;
+        width = rect.width;
+        height = rect.height;
+        page->mask_valid = false;
+    }
 
-    jsLine* lines = darrayCreate(jsLine);
+    uint32_t* buffer = (uint32_t*)get_upload_buffer(ctx, (size_t)width * height * 4);
+    if (!buffer) return;
+    canvas_read_rect(&ctx->canvas, min_x, min_y, width, height, buffer, width);
+
+    if (page->tex.id == 0) {
+        Image img = {
+            .data = buffer,
+            .width = width,
+            .height = height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        };
+        page->tex = LoadTextureFromImage(img);
+        SetTextureFilter(page->tex, TEXTURE_FILTER_POINT);
+    }
+    else {
+        UpdateTextureRec(page->tex, (Rectangle){ min_x - rect.x, min_y - rect.y, width, height }, buffer);
+    }
+    page->stale = false;
 
-    int32_t line_index = 0;
-    while (token != NULL) {
-        char line[MAX_JAVASCRIPT_LINE];
-        strncpy(line, token, MAX_JAVASCRIPT_LINE - 1);
-        line[MAX_JAVASCRIPT_LINE - 1] = '\0';
-        parse_javascript_line(ctx, line, line_index, &lines);
+    update_page_mask_region(ctx, page, rect, min_x, min_y, width, height);
+}
 
-        token = strtok(NULL, delim);
-        line_index++;
+#ifndef DRAW_BENCH /* Only the window loop uses these */
+/*
+   Uploads only the part of the canvas that changed since the last call, split
+   up by page. Pages that werent drawn yet stay stale and get uploaded once
+   they become visible.
+*/
+static void upload_dirty_region(Context* ctx) {
+    DirtyRect* d = &ctx->dirty;
+    if (!d->valid) return;
+    d->valid = false;
+
+    int32_t page_x0 = d->min_x / CANVAS_PAGE_SIZE;
+    int32_t page_y0 = d->min_y / CANVAS_PAGE_SIZE;
+    int32_t page_x1 = d->max_x / CANVAS_PAGE_SIZE;
+    int32_t page_y1 = d->max_y / CANVAS_PAGE_SIZE;
+
+    for (int32_t py = page_y0; py <= page_y1; py++) {
+        for (int32_t px = page_x0; px <= page_x1; px++) {
+            if (get_page(ctx, px, py)->stale) continue;
+
+            Rectangle rect = get_page_rect(ctx, px, py);
+            int32_t min_x = MAX(d->min_x, (int32_t)rect.x);
+            int32_t min_y = MAX(d->min_y, (int32_t)rect.y);
+            int32_t max_x = MIN(d->max_x, (int32_t)(rect.x + rect.width) - 1);
+            int32_t max_y = MIN(d->max_y, (int32_t)(rect.y + rect.height) - 1);
+            update_page(ctx, px, py, min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+        }
     }
+}
+#endif
 
-    fclose(file);
-
-    Vector2I dim = get_image_dim_from_js(lines);
+static void free_canvas(Context* ctx) {
+    if (ctx->pages) {
+        for (int32_t i = 0; i < ctx->pages_x * ctx->pages_y; i++) unload_page_textures(&ctx->pages[i]);
+        free(ctx->pages);
+        ctx->pages = NULL;
+    }
 
-    ctx->new_image_width = dim.x;
-    ctx->new_image_height = dim.y;
+    canvas_destroy(&ctx->canvas);
+}
 
-    ctx->image_data = malloc(dim.x * dim.y * 4);
-    if (!ctx->image_data) {
-        fprintf(stderr, "failed to allocate image\n");
-        exit(1);
+/* The old canvas is only replaced once the new one and its pages exist, on failure nothing changes */
+bool create_canvas(Context* ctx, int32_t width, int32_t height, const uint8_t* pixels) {
+    Canvas canvas;
+    if (!canvas_create(&canvas, width, height, pack_color(BLACK))) return false;
+
+    int32_t pages_x = (width + CANVAS_PAGE_SIZE - 1) / CANVAS_PAGE_SIZE;
+    int32_t pages_y = (height + CANVAS_PAGE_SIZE - 1) / CANVAS_PAGE_SIZE;
+    CanvasPage* pages = calloc((size_t)pages_x * pages_y, sizeof(CanvasPage));
+    if (!pages) {
+        fprintf(stderr, "Failed to allocate canvas pages\n");
+        canvas_destroy(&canvas);
+        return false;
     }
+    for (int32_t i = 0; i < pages_x * pages_y; i++) pages[i].stale = true;
 
-    int32_t total = ctx->new_image_width * ctx->new_image_height;
-    for (int32_t i = 0; i < total; i++) {
-        ctx->image_data[i * 4] = 0;
-        ctx->image_data[i * 4 + 1] = 0;
-        ctx->image_data[i * 4 + 2] = 0;
-        ctx->image_data[i * 4 + 3] = 255;
-    }
+    wait_for_raster(ctx);
 
-    write_data_to_img(ctx, lines);
+    /* History entries still hold tiles of the old canvas */
+    if (ctx->history) history_clear(ctx->history);
+    ctx->recording = NULL;
+    free_canvas(ctx);
+    ctx->dirty.valid = false;
 
-    Image img = GenImageColor(ctx->new_image_width, ctx->new_image_height, BLACK);
-    ctx->loaded_tex = LoadTextureFromImage(img);
-    UnloadImage(img);
+    ctx->canvas = canvas;
+    if (pixels) canvas_write_rect(&ctx->canvas, 0, 0, width, height, (const uint32_t*)pixels, width);
+    canvas_checkpoint(&ctx->canvas);
 
-    SetTextureFilter(ctx->loaded_tex, TEXTURE_FILTER_POINT);
-    UpdateTexture(ctx->loaded_tex, ctx->image_data);
+    ctx->pages = pages;
+    ctx->pages_x = pages_x;
+    ctx->pages_y = pages_y;
 
-    ctx->loaded_ratio = (float)ctx->loaded_tex.width / (float)ctx->loaded_tex.height;
+    ctx->new_image_width = width;
+    ctx->new_image_height = height;
+    ctx->loaded_ratio = (float)width / (float)height;
     ctx->mode = UI_MODE_IMAGE_EDITING;
-
-    darrayDestroy(lines);
+    return true;
 }
 
-static inline bool compare_colors(Color a, Color b) {
-    return (a.r == b.r &&
-            a.g == b.g &&
-            a.b == b.b &&
-            a.a == b.a);
-}
+/* stbi wants one flat image, so this is the only place the whole canvas gets copied */
+void write_canvas_png(Context* ctx, const char* path) {
+    wait_for_raster(ctx);
+    int32_t w = ctx->new_image_width;
+    int32_t h = ctx->new_image_height;
 
-/* Assumes Index is valid */
-static inline Color get_color_from_index(Context* ctx, int32_t index) {
-    return (Color){
-        .r = ctx->image_data[index],
-        .g = ctx->image_data[index + 1],
-        .b = ctx->image_data[index + 2],
-        .a = ctx->image_data[index + 3],
-    };
-}
+    uint32_t* pixels = malloc((size_t)w * h * 4);
+    if (!pixels) {
+        fprintf(stderr, "Failed to allocate image for saving\n");
+        return;
+    }
 
-static inline void write_pixel(Context* ctx, int32_t index, Color c) {
-    ctx->image_data[index + 0] = c.r;
-    ctx->image_data[index + 1] = c.g;
-    ctx->image_data[index + 2] = c.b;
-    ctx->image_data[index + 3] = c.a;
+    canvas_read_rect(&ctx->canvas, 0, 0, w, h, pixels, w);
+    if (!stbi_write_png(path, w, h, 4, pixels, w * 4)) {
+        fprintf(stderr, "Failed to write: %s\n", path);
+    }
+    free(pixels);
 }
 
+#ifndef DRAW_BENCH /* Only the window loop uses these */
 static void generate_rainbow_circle(Texture2D* result) {
     Image img = GenImageColor(COLOR_PICKER_RESOLUTION, COLOR_PICKER_RESOLUTION, BLACK); 
     Vector2I circle_center = {
@@ -299,28 +425,31 @@ static void generate_rainbow_circle(Texture2D* result) {
     *result = LoadTextureFromImage(img);
     UnloadImage(img);
 }
+#endif
 
 void image_to_javascript(Context* ctx, FILE* fd, char* name_x, char* name_y) {
-    for (int32_t y = 0; y < ctx->new_image_height; y++) {
-        for (int32_t x = 0; x < ctx->new_image_width; x++) {
-            int32_t index = (y * ctx->new_image_width + x) * 4;
-            
-            Color cmp_color = get_color_from_index(ctx, index);
-            uint32_t color = 0;
-            color |= cmp_color.b;
-            color |= cmp_color.g << 8;
-            color |= cmp_color.r << 16;
-
-            if (compare_colors(cmp_color, ctx->ignore_color)) continue;
-
-            int32_t pos_x = x - ctx->new_image_width / 2;
-            int32_t pos_y = -(y - ctx->new_image_height / 2);
-            if (ctx->export_x_mirrored) pos_x *= -1;
-            fprintf(fd, "Canvas.rect(%s%+.2f, %s%+.2f, %.2f, %.2f, {fill:\"#%06X\"}),\n", name_x,
-                    pos_x * ctx->export_scale, name_y, pos_y * ctx->export_scale,
-                    1.5f * ctx->export_scale, 1.5f * ctx->export_scale, color);
-        }
-    }
+    wait_for_raster(ctx);
+    double start = platGetTime();
+
+    jsExportOptions options = {
+        .ignore_color = pack_color(ctx->ignore_color),
+        .scale = ctx->export_scale,
+        .x_mirrored = ctx->export_x_mirrored,
+        .merge_rects = ctx->export_merge_rects,
+        .palette = ctx->export_palette,
+        .compress = ctx->export_compress,
+        .threads = ctx->export_threads,
+    };
+    jsExportResult result = js_export_canvas(&ctx->canvas, fd, name_x, name_y, &options);
+    if (result.failed) fprintf(stderr, "Export failed, output is incomplete\n");
+
+    double elapsed = platGetTime() - start;
+    if (elapsed <= 0.0) elapsed = 1e-9;
+
+    double pixels = (double)ctx->new_image_width * ctx->new_image_height;
+    printf("Exported %llu bytes in %.3fs with %d threads (%.2f MB/s, %.2f MPixels/s)\n",
+            (unsigned long long)result.bytes_written, elapsed, result.thread_count,
+            result.bytes_written / elapsed / (1024.0 * 1024.0), pixels / elapsed / 1e6);
 }
 
 static Rectangle get_image_dst(Context* ctx) {
@@ -360,21 +489,23 @@ static inline int32_t vec_to_img(Context* ctx, Vector2I vec) {
     return (vec.y * ctx->new_image_width + vec.x) * 4;
 }
 
-/* TODO: make performant */
-static void draw_ignored_pixels(Context* ctx, Rectangle dst, float dst_pixel_width, float dst_pixel_height) {
-    for (int32_t y = 0; y < ctx->new_image_width; y++) {
-        for (int32_t x = 0; x < ctx->new_image_height; x++) {
-            int32_t index = vec_to_img(ctx, (Vector2I){ x, y });
+/* Masks are rebuilt per page when they are needed, solid pages are just a rectangle */
+static void draw_ignored_page(Context* ctx, CanvasPage* page, Rectangle rect, Rectangle page_dst) {
+    Color tint = Fade(PURPLE, 0.5f);
 
-            if (index < 0) continue;
-            Color pixel_color = get_color_from_index(ctx, index);
+    if (page->solid) {
+        if (page->solid_color == pack_color(ctx->ignore_color)) DrawRectangleRec(page_dst, tint);
+        return;
+    }
 
-            if (ctx->draw_ignored_pixels && compare_colors(pixel_color, ctx->ignore_color)) {
-                DrawRectangle(dst.x + x * dst_pixel_width,
-                        dst.y + y * dst_pixel_height, dst_pixel_width, dst_pixel_height, Fade(PURPLE, 0.5f));
-            }
-        }
+    if (!page->mask_valid) {
+        if (!ctx->canvas_locked) return;
+        rebuild_page_mask(ctx, page, rect);
+        if (!page->mask_valid) return;
     }
+
+    Rectangle src = { 0, 0, rect.width, rect.height };
+    DrawTexturePro(page->mask, src, page_dst, (Vector2){0, 0}, 0.0f, tint);
 }
 
 static inline int32_t get_number_of_digits(int32_t num) {
@@ -429,173 +560,484 @@ static void draw_debug_mode(Context* ctx, Rectangle dst, float dst_pixel_width,
     }
 }
 
+/*
+   Only the pages inside the view get drawn, stale ones are uploaded right
+   before. That needs the canvas, if the worker has it locked stale pages
+   wait for the next frame.
+*/
 void draw_image(Context* ctx) {
     if (ctx->mode != UI_MODE_IMAGE_EDITING) return;
-    Rectangle src = {
-        .width = ctx->loaded_tex.width,
-        .height = ctx->loaded_tex.height,
-    };
 
     Rectangle dst = get_image_dst(ctx);
     float dst_pixel_width = dst.width / (float)ctx->new_image_width;
     float dst_pixel_height = dst.height / (float)ctx->new_image_height;
 
-    DrawTexturePro(ctx->loaded_tex, src, dst, (Vector2){0, 0}, 0.0f, WHITE);
+    Vector2 view_min = GetScreenToWorld2D((Vector2){ 0, 0 }, ctx->camera);
+    Vector2 view_max = GetScreenToWorld2D((Vector2){ ctx->window_width, ctx->window_height }, ctx->camera);
+    Rectangle view = { view_min.x, view_min.y, view_max.x - view_min.x, view_max.y - view_min.y };
+
+    IgnoredMask* mask = &ctx->ignored_mask;
+    if (!mask->valid || !compare_colors(mask->ignore_color, ctx->ignore_color)) {
+        for (int32_t i = 0; i < ctx->pages_x * ctx->pages_y; i++) ctx->pages[i].mask_valid = false;
+        mask->ignore_color = ctx->ignore_color;
+        mask->valid = true;
+    }
+
+    for (int32_t py = 0; py < ctx->pages_y; py++) {
+        for (int32_t px = 0; px < ctx->pages_x; px++) {
+            Rectangle rect = get_page_rect(ctx, px, py);
+            Rectangle page_dst = {
+                dst.x + rect.x * dst_pixel_width,
+                dst.y + rect.y * dst_pixel_height,
+                rect.width * dst_pixel_width,
+                rect.height * dst_pixel_height,
+            };
+            if (!CheckCollisionRecs(page_dst, view)) continue;
+
+            CanvasPage* page = get_page(ctx, px, py);
+            if (page->stale && ctx->canvas_locked) update_page(ctx, px, py, rect.x, rect.y, rect.width, rect.height);
+            if (page->stale && page->tex.id == 0 && !page->solid) continue;
+
+            if (page->solid) {
+                DrawRectangleRec(page_dst, unpack_color(page->solid_color));
+            }
+            else {
+                Rectangle src = { 0, 0, rect.width, rect.height };
+                DrawTexturePro(page->tex, src, page_dst, (Vector2){0, 0}, 0.0f, WHITE);
+            }
+
+            if (ctx->draw_ignored_pixels) draw_ignored_page(ctx, page, rect, page_dst);
+        }
+    }
 
-    if (ctx->draw_ignored_pixels) draw_ignored_pixels(ctx, dst, dst_pixel_width, dst_pixel_height);
     if (ctx->debug_mode) draw_debug_mode(ctx, dst, dst_pixel_width, dst_pixel_height);
 
     DrawRectangleLines(0, 0, dst.width, dst.height, RAYWHITE);
 }
 
-static bool pixel_saved(Context* ctx, int32_t index) {
-    int32_t pixel_index = index / 4;
+/* Largest dx with dx * dx + dy * dy <= radius_squared, -1 if the row misses the disc */
+static inline int32_t disc_half_width(float radius_squared, int32_t extent, int32_t dy) {
+    float rest = radius_squared - (float)(dy * dy);
+    if (rest < 0.0f) return -1;
 
-    if (ctx->pixel_stamp[pixel_index] == ctx->current_stamp) {
-        return true;
-    }
-    ctx->pixel_stamp[pixel_index] = ctx->current_stamp;
-    return false;
+    /* sqrtf can be off by one either way, the integer test decides */
+    int32_t half = MIN((int32_t)sqrtf(rest), extent);
+    while (half < extent && (float)((half + 1) * (half + 1) + dy * dy) <= radius_squared) half++;
+    while (half >= 0 && (float)(half * half + dy * dy) > radius_squared) half--;
+    return half;
 }
 
-void draw_circle(Context* ctx, Vector2 pos_world, Rectangle dst, Color c) {
-    float radius = ctx->brush_size;
+/*
+   Filled row by row, each row of the disc is one span that gets clipped
+   to the canvas and written with canvas_fill_span, so a big brush costs a
+   sqrt per row instead of a test per pixel.
+*/
+void draw_circle(Context* ctx, Vector2I pos_image, float radius, Color c) {
     float radius_squared = radius * radius;
 
-    Vector2I pos_image = screen_to_image_space(ctx, pos_world, dst);
+    int32_t extent = (int32_t)radius;
+    int32_t min_x = MAX(pos_image.x - extent, 0);
+    int32_t min_y = MAX(pos_image.y - extent, 0);
+    int32_t max_x = MIN(pos_image.x + extent, ctx->new_image_width - 1);
+    int32_t max_y = MIN(pos_image.y + extent, ctx->new_image_height - 1);
+    if (min_x > max_x || min_y > max_y) return;
+    mark_dirty(ctx, min_x, min_y, max_x, max_y);
 
-    for (int32_t i = -radius; i <= radius; i++) {
-        for (int32_t j = -radius; j <= radius; j++) {
-            Vector2I pos = pos_image;
-            pos.x += i;
-            pos.y += j;
-            if (i * i + j * j <= radius_squared) {
-                int32_t index = vec_to_img(ctx, pos);
-                if (index == -1) continue;
+    c.a = 255;
+    uint32_t packed = pack_color(c);
 
-                if (!pixel_saved(ctx, index)) {
-                    int32_t idx = ctx->save_states_index - 1;
-                    if (idx < 0) idx = UNDO_COUNT - 1;
+    for (int32_t y = min_y; y <= max_y; y++) {
+        int32_t half = disc_half_width(radius_squared, extent, y - pos_image.y);
+        if (half < 0) continue;
 
-                    Color original_color = get_color_from_index(ctx, index);
+        int32_t x0 = MAX(pos_image.x - half, 0);
+        int32_t x1 = MIN(pos_image.x + half, ctx->new_image_width - 1);
+        if (x0 <= x1) canvas_fill_span(&ctx->canvas, x0, y, x1 - x0 + 1, packed);
+    }
+}
 
-                    PixelState s = {
-                        .index = index,
-                        .color = original_color,
-                    };
+typedef struct Capsule {
+    float ax, ay;
+    float dx, dy; /* b - a */
+    float length_squared;
+    float radius_squared;
+} Capsule;
+
+static inline bool capsule_contains(const Capsule* c, int32_t x, int32_t y) {
+    float px = x - c->ax;
+    float py = y - c->ay;
+    float t = Clamp((px * c->dx + py * c->dy) / c->length_squared, 0.0f, 1.0f);
+    float ex = px - t * c->dx;
+    float ey = py - t * c->dy;
+    return ex * ex + ey * ey <= c->radius_squared;
+}
 
-                    darrayPush(ctx->save_states[idx].data.brush.pixels, s);
-                }
+/* Grows [lo, hi] by the part of the row that is within radius of the disc at (cx, cy) */
+static inline void extend_row_by_disc(float radius_squared, float cx, float cy, float y, float* lo, float* hi) {
+    float rest = radius_squared - (y - cy) * (y - cy);
+    if (rest < 0.0f) return;
+    float half = sqrtf(rest);
+    *lo = fminf(*lo, cx - half);
+    *hi = fmaxf(*hi, cx + half);
+}
 
-                ctx->image_data[index] = c.r;
-                ctx->image_data[index + 1] = c.g;
-                ctx->image_data[index + 2] = c.b;
-                ctx->image_data[index + 3] = 255;
-            }
-        }
+/*
+   Row extent of the capsule: the discs at both ends plus the band between
+   them, which is where the projection onto the segment is in [0, 1] and
+   the distance to the line is at most the radius. The result is only a
+   float estimate, capsule_contains has the final say on the end pixels.
+*/
+static bool capsule_row(const Capsule* c, float radius, int32_t y, int32_t* x0, int32_t* x1) {
+    float lo = INFINITY, hi = -INFINITY;
+    extend_row_by_disc(c->radius_squared, c->ax, c->ay, y, &lo, &hi);
+    extend_row_by_disc(c->radius_squared, c->ax + c->dx, c->ay + c->dy, y, &lo, &hi);
+
+    float py = y - c->ay;
+    float band_lo = -INFINITY, band_hi = INFINITY;
+    float reach = radius * sqrtf(c->length_squared);
+
+    /* |dx * py - dy * px| <= radius * length */
+    if (c->dy != 0.0f) {
+        float u0 = (c->dx * py - reach) / c->dy;
+        float u1 = (c->dx * py + reach) / c->dy;
+        band_lo = fmaxf(band_lo, fminf(u0, u1));
+        band_hi = fminf(band_hi, fmaxf(u0, u1));
+    }
+    else if (fabsf(c->dx * py) > reach) {
+        band_hi = -INFINITY;
+    }
+
+    /* 0 <= dx * px + dy * py <= length^2 */
+    if (c->dx != 0.0f) {
+        float u0 = -c->dy * py / c->dx;
+        float u1 = (c->length_squared - c->dy * py) / c->dx;
+        band_lo = fmaxf(band_lo, fminf(u0, u1));
+        band_hi = fminf(band_hi, fmaxf(u0, u1));
+    }
+    else if (c->dy * py < 0.0f || c->dy * py > c->length_squared) {
+        band_hi = -INFINITY;
+    }
+
+    if (band_lo <= band_hi) {
+        lo = fminf(lo, c->ax + band_lo);
+        hi = fmaxf(hi, c->ax + band_hi);
+    }
+    if (lo > hi) return false;
+
+    int32_t left = (int32_t)floorf(lo + 0.5f);
+    int32_t right = (int32_t)ceilf(hi - 0.5f);
+    while (capsule_contains(c, left - 1, y)) left--;
+    while (left <= right && !capsule_contains(c, left, y)) left++;
+    while (capsule_contains(c, right + 1, y)) right++;
+    while (right >= left && !capsule_contains(c, right, y)) right--;
+
+    *x0 = left;
+    *x1 = right;
+    return left <= right;
+}
+
+/*
+   Fills everything within radius of the segment between two mouse
+   positions once, instead of stamping discs along it. A fast flick costs
+   the pixels it covers and not samples times brush area. The ends are
+   the same discs draw_circle makes.
+*/
+void draw_stroke(Context* ctx, Vector2I a, Vector2I b, float radius, Color c) {
+    if (a.x == b.x && a.y == b.y) {
+        draw_circle(ctx, b, radius, c);
+        return;
     }
+
+    Capsule capsule = {
+        .ax = a.x, .ay = a.y,
+        .dx = b.x - a.x, .dy = b.y - a.y,
+        .radius_squared = radius * radius,
+    };
+    capsule.length_squared = capsule.dx * capsule.dx + capsule.dy * capsule.dy;
+
+    int32_t extent = (int32_t)radius;
+    int32_t min_y = MAX(MIN(a.y, b.y) - extent, 0);
+    int32_t max_y = MIN(MAX(a.y, b.y) + extent, ctx->new_image_height - 1);
+    int32_t min_x = MAX(MIN(a.x, b.x) - extent, 0);
+    int32_t max_x = MIN(MAX(a.x, b.x) + extent, ctx->new_image_width - 1);
+    if (min_x > max_x || min_y > max_y) return;
+    mark_dirty(ctx, min_x, min_y, max_x, max_y);
+
+    c.a = 255;
+    uint32_t packed = pack_color(c);
+
+    for (int32_t y = min_y; y <= max_y; y++) {
+        int32_t x0, x1;
+        if (!capsule_row(&capsule, radius, y, &x0, &x1)) continue;
+
+        x0 = MAX(x0, 0);
+        x1 = MIN(x1, ctx->new_image_width - 1);
+        if (x0 <= x1) canvas_fill_span(&ctx->canvas, x0, y, x1 - x0 + 1, packed);
+    }
+}
+
+typedef struct FillSpan {
+    int32_t x1;
+    int32_t x2;
+    int32_t y;
+    int32_t dy;
+} FillSpan;
+
+static inline void push_fill_span(MemArena* arena, int32_t* count, int32_t x1, int32_t x2, int32_t y, int32_t dy) {
+    FillSpan* span = PUSH_STRUCT_NZ(arena, FillSpan);
+    if (!span) return; /* Out of reserve, that part stays unfilled */
+    *span = (FillSpan){ x1, x2, y, dy };
+    (*count)++;
+}
+
+/* (x, y) has to be a pixel that gets filled */
+static inline void seed_fill(MemArena* arena, int32_t* count, int32_t x, int32_t y) {
+    push_fill_span(arena, count, x, x, y, 1);
+    push_fill_span(arena, count, x, x, y - 1, -1);
 }
 
-void bucket_fill(Context* ctx, Vector2I start) {
+/*
+   Span based scanline fill (Heckbert). Whole runs of a row are filled at
+   once and only the runs left to visit end up on the stack, which lives in
+   the scratch arena. Pixels are compared as packed 32 bit values.
+   Everything connected that doesnt have the draw color already gets filled.
+*/
+void bucket_fill(Context* ctx, Vector2I start, Color c) {
     int32_t w = ctx->new_image_width;
     int32_t h = ctx->new_image_height;
+    Canvas* canvas = &ctx->canvas;
 
-    if (compare_colors(ctx->draw_color, ctx->ignore_color))
+    if (start.x < 0 || start.y < 0 || start.x >= w || start.y >= h)
         return;
 
-    Vector2I *stack = malloc(sizeof(Vector2I) * w * h);
-    int32_t top = 0;
+    uint32_t draw = pack_color(c);
 
-    if (start.x < 0 || start.y < 0 || start.x >= w || start.y >= h) {
-        free(stack);
-        return;
+    MemArena* arena = ctx->scratch_arena;
+    u64 arena_pos = arena->pos;
+    FillSpan* stack = (FillSpan*)((u8*)arena + ALIGN_UP_POW2(arena->pos, ARENA_ALIGN));
+    int32_t count = 0;
+
+    int32_t min_x = start.x, max_x = start.x;
+    int32_t min_y = start.y, max_y = start.y;
+
+    /* Clicking on the draw color fills whatever touches that pixel */
+    if (canvas_get(canvas, start.x, start.y) != draw) {
+        seed_fill(arena, &count, start.x, start.y);
     }
+    else {
+        Vector2I neighbors[4] = {
+            { start.x - 1, start.y },
+            { start.x + 1, start.y },
+            { start.x, start.y - 1 },
+            { start.x, start.y + 1 }
+        };
 
-    int32_t idx = vec_to_img(ctx, start);
-    Color c = get_color_from_index(ctx, idx);
+        for (int32_t i = 0; i < 4; i++) {
+            Vector2I n = neighbors[i];
+            if (n.x < 0 || n.y < 0 || n.x >= w || n.y >= h) continue;
+            if (canvas_get(canvas, n.x, n.y) != draw) seed_fill(arena, &count, n.x, n.y);
+        }
+    }
 
-    ctx->image_data[idx + 0] = ctx->draw_color.r;
-    ctx->image_data[idx + 1] = ctx->draw_color.g;
-    ctx->image_data[idx + 2] = ctx->draw_color.b;
-    ctx->image_data[idx + 3] = ctx->draw_color.a;
+    /* Rows are scanned a tile segment at a time, uniform tiles are skipped as a whole */
+    while (count > 0) {
+        FillSpan span = stack[--count];
+        arenaPop(arena, sizeof(FillSpan));
 
-    stack[top++] = start;
+        if (span.y < 0 || span.y >= h) continue;
 
-    while (top > 0) {
-        Vector2I pos = stack[--top];
+        int32_t y = span.y;
+        int32_t x1 = span.x1;
+        int32_t x2 = span.x2;
+        int32_t x = x1;
 
-        Vector2I neighbors[4] = {
-            { pos.x - 1, pos.y },
-            { pos.x + 1, pos.y },
-            { pos.x, pos.y - 1 },
-            { pos.x, pos.y + 1 }
-        };
+        /* Extend to the left of the span, the pixels get filled below */
+        if (canvas_get(canvas, x, y) != draw) {
+            x = canvas_scan_left(canvas, x - 1, 0, y, draw, true) + 1;
+            if (x < x1) push_fill_span(arena, &count, x, x1 - 1, y - span.dy, -span.dy);
+            x1 = x;
+        }
 
-        for (int i = 0; i < 4; i++) {
-            Vector2I n = neighbors[i];
+        while (x1 <= x2) {
+            int32_t end = canvas_scan_right(canvas, x1, w, y, draw, true);
+            if (end > x1) {
+                canvas_fill_span(canvas, x1, y, end - x1, draw);
+                x1 = end;
+            }
 
-            if (n.x < 0 || n.y < 0 || n.x >= w || n.y >= h)
-                continue;
+            if (x1 > x) {
+                push_fill_span(arena, &count, x, x1 - 1, y + span.dy, span.dy);
+                if (x < min_x) min_x = x;
+                if (x1 - 1 > max_x) max_x = x1 - 1;
+                if (y < min_y) min_y = y;
+                if (y > max_y) max_y = y;
+            }
+            if (x1 - 1 > x2) push_fill_span(arena, &count, x2 + 1, x1 - 1, y - span.dy, -span.dy);
 
-            int32_t nidx = vec_to_img(ctx, n);
-            Color nc = get_color_from_index(ctx, nidx);
+            x1 = canvas_scan_right(canvas, x1 + 1, x2, y, draw, false);
+            x = x1;
+        }
+    }
 
-            if (!compare_colors(nc, ctx->ignore_color) && compare_colors(nc, ctx->draw_color))
-                continue;
+    arenaPopTo(arena, arena_pos);
+    canvas_compact(canvas, min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+    mark_dirty(ctx, min_x, min_y, max_x, max_y);
+}
 
-            ctx->image_data[nidx + 0] = ctx->draw_color.r;
-            ctx->image_data[nidx + 1] = ctx->draw_color.g;
-            ctx->image_data[nidx + 2] = ctx->draw_color.b;
-            ctx->image_data[nidx + 3] = ctx->draw_color.a;
+/*
+   Save states work on whole tiles. Starting one makes the current tiles the
+   canvas checkpoint, painting then copies every tile it touches first (see
+   canvas.h). When the save state is done the checkpoint versions of the
+   changed tiles move into the history entry. Undo and redo just swap those
+   tiles with the ones on the canvas, so the same record works both ways and
+   a fill over the whole image costs the same as a small stroke.
+   Tiles in the history nobody else uses get packed, a 1px stroke would
+   otherwise keep 16 KiB per tile it crosses.
+*/
+
+/* Bytes a tile version in the history keeps alive */
+static inline i64 tile_state_size(const TileState* state) {
+    if (state->packed) return state->packed_size;
+    return state->ref.tile ? (i64)sizeof(CanvasTile) : 0;
+}
+
+static void pack_tile_state(Canvas* canvas, TileState* state) {
+    CanvasTile* t = state->ref.tile;
+    if (!t || t->refs != 1) return;
+
+    state->packed = canvas_pack_tile(t, &state->packed_size);
+    if (!state->packed) return;
+    canvas_release(canvas, state->ref);
+    state->ref.tile = NULL;
+}
 
-            stack[top++] = n;
+static void finish_save_state(Context* ctx) {
+    HistoryEntry* entry = ctx->recording;
+    if (!entry) return;
+    ctx->recording = NULL;
+
+    Canvas* canvas = &ctx->canvas;
+    int32_t tile_count = canvas->tiles_x * canvas->tiles_y;
+    for (int32_t tile = canvas_next_change(canvas, 0); tile < tile_count; tile = canvas_next_change(canvas, tile + 1)) {
+        CanvasTileRef old = canvas_take_change(canvas, tile);
+
+        TileState* state = history_push(ctx->history, entry);
+        if (!state) {
+            fprintf(stderr, "Out of history memory, save state is incomplete\n");
+            canvas_release(canvas, old);
+            continue;
         }
+
+        *state = (TileState){ .tile = tile, .ref = old };
+        pack_tile_state(canvas, state);
+        history_charge(ctx->history, entry, tile_state_size(state));
     }
+}
+
+static void release_save_state(HistoryEntry* entry, void* user_data) {
+    Context* ctx = user_data;
+    if (entry == ctx->recording) ctx->recording = NULL;
 
-    free(stack);
+    for (HistoryChunk* chunk = entry->first; chunk; chunk = chunk->next) {
+        TileState* states = (TileState*)HISTORY_CHUNK_DATA(chunk);
+        for (uint32_t i = 0; i < chunk->count; i++) {
+            canvas_release(&ctx->canvas, states[i].ref);
+            free(states[i].packed);
+        }
+    }
 }
 
 static void new_save_state(Context* ctx, enum SaveStateType type) {
-    if (ctx->save_states_index == UNDO_COUNT)
-        ctx->save_states_index = 0;
+    if (!ctx->history) return;
 
-    SaveState* s = &ctx->save_states[ctx->save_states_index];
+    finish_save_state(ctx);
+    ctx->recording = history_begin(ctx->history, type, sizeof(TileState));
 
-    if (s->valid) {
-        if (s->type == SAVE_STATE_TYPE_BRUSH) {
-            darrayDestroy(s->data.brush.pixels);
-        }
-        else if (s->type == SAVE_STATE_TYPE_BUCKET_FILL) {
+    printf("Saved: %u entries, %.2f MB\n", ctx->history->entry_count, ctx->history->used / (1024.0 * 1024.0));
+}
+
+
+static void apply_save_state(Context* ctx, HistoryEntry* entry) {
+    Canvas* canvas = &ctx->canvas;
+
+    for (HistoryChunk* chunk = entry->first; chunk; chunk = chunk->next) {
+        TileState* states = (TileState*)HISTORY_CHUNK_DATA(chunk);
+
+        for (uint32_t i = 0; i < chunk->count; i++) {
+            TileState* s = &states[i];
+            i64 size = tile_state_size(s);
 
+            CanvasTileRef ref = s->ref;
+            if (s->packed) {
+                ref.tile = canvas_unpack_tile(canvas, s->packed);
+                if (!ref.tile) continue;
+                free(s->packed);
+                s->packed = NULL;
+            }
+
+            /* The version that comes off the canvas gets packed in turn */
+            s->ref = canvas_swap_tile(canvas, s->tile, ref);
+            pack_tile_state(canvas, s);
+            history_charge(ctx->history, entry, tile_state_size(s) - size);
+
+            int32_t x = (s->tile % canvas->tiles_x) << CANVAS_TILE_SHIFT;
+            int32_t y = (s->tile / canvas->tiles_x) << CANVAS_TILE_SHIFT;
+            mark_dirty(ctx, x, y, MIN(x + CANVAS_TILE_SIZE, canvas->width) - 1, MIN(y + CANVAS_TILE_SIZE, canvas->height) - 1);
         }
     }
+}
 
-    s->type = type;
-    s->valid = true;
+static void undo(Context* ctx) {
+    finish_save_state(ctx);
 
-    if (type == SAVE_STATE_TYPE_BRUSH) {
-        s->data.brush.pixels = darrayCreate(PixelState);
+    HistoryEntry* entry = ctx->history ? history_undo(ctx->history) : NULL;
+    if (!entry) {
+        fprintf(stderr, "No valid safe state anymore\n");
+        return;
     }
 
-    ctx->save_states_index++;
-    ctx->current_stamp++;
-    printf("Saved: %d\n", ctx->save_states_index - 1);
+    apply_save_state(ctx, entry);
 }
 
+static void redo(Context* ctx) {
+    finish_save_state(ctx);
+
+    HistoryEntry* entry = ctx->history ? history_redo(ctx->history) : NULL;
+    if (!entry) {
+        fprintf(stderr, "Nothing to redo\n");
+        return;
+    }
+
+    apply_save_state(ctx, entry);
+}
+
+/* Runs on the raster worker, or right away if there is none */
+static void execute_raster_command(const RasterCommand* command, void* user_data) {
+    Context* ctx = user_data;
+    Vector2I from = { command->x0, command->y0 };
+    Vector2I to = { command->x1, command->y1 };
+    Color color = unpack_color(command->color);
+
+    switch (command->type) {
+        case RASTER_COMMAND_SAVE_STATE: new_save_state(ctx, command->kind); break;
+        case RASTER_COMMAND_DISC: draw_circle(ctx, from, command->radius, color); break;
+        case RASTER_COMMAND_STROKE: draw_stroke(ctx, from, to, command->radius, color); break;
+        case RASTER_COMMAND_FILL: bucket_fill(ctx, from, color); break;
+        case RASTER_COMMAND_UNDO: undo(ctx); break;
+        case RASTER_COMMAND_REDO: redo(ctx); break;
+        default: break;
+    }
+}
+
+static void post_raster_command(Context* ctx, RasterCommand command) {
+    if (ctx->raster) raster_worker_push(ctx->raster, command);
+    else execute_raster_command(&command, ctx);
+}
 
 void update_image_data(Context* ctx) {
     if (ctx->mode != UI_MODE_IMAGE_EDITING) return;
     if (ctx->above_ui) return; 
 
-    if (!ctx->pixel_stamp) {
-        ctx->pixel_stamp = calloc(ctx->new_image_width * ctx->new_image_height, sizeof(uint32_t));
-        if (!ctx->pixel_stamp) {
-            fprintf(stderr, "Failed to allocate stamp buffer\n");
-            return;
-        }
-        ctx->current_stamp = 1;
-    }
-
     if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
         bool first_time = !ctx->drawing;
         Vector2 mouse_screen = GetMousePosition();
@@ -610,7 +1052,9 @@ void update_image_data(Context* ctx) {
         if (ctx->pick_color_draw) {
             Vector2I pos = screen_to_image_space(ctx, mouse, dst);
             int32_t index = vec_to_img(ctx, pos);
+            lock_canvas(ctx);
             ctx->draw_color = get_color_from_index(ctx, index);
+            unlock_canvas(ctx);
             ctx->brush_colors[ctx->current_brush] = ctx->draw_color;
             ctx->pick_color_draw = false;
             return;
@@ -619,90 +1063,139 @@ void update_image_data(Context* ctx) {
         if (ctx->pick_color_ignore) {
             Vector2I pos = screen_to_image_space(ctx, mouse, dst);
             int32_t index = vec_to_img(ctx, pos);
+            lock_canvas(ctx);
             ctx->ignore_color = get_color_from_index(ctx, index);
+            unlock_canvas(ctx);
             ctx->pick_color_ignore = false;
             return;
         }
 
-        if (first_time) {
-            new_save_state(ctx, SAVE_STATE_TYPE_BRUSH); // TODO: tmp with hardcoded type
-        }
+        bool filling = ctx->ui_state.current_tool == UI_TOOL_BUCKET_FILL;
+        if (filling && compare_colors(ctx->draw_color, ctx->ignore_color)) return;
 
-        if (ctx->ui_state.current_tool == UI_TOOL_BUCKET_FILL) {
-            Vector2 curr_word = GetScreenToWorld2D(ctx->current_mouse_pos, ctx->camera);
-            Vector2I pos_image = screen_to_image_space(ctx, curr_word, dst);
-            bucket_fill(ctx, pos_image);
+        if (first_time) {
+            RasterCommand save = { .type = RASTER_COMMAND_SAVE_STATE };
+            save.kind = filling ? SAVE_STATE_TYPE_BUCKET_FILL : SAVE_STATE_TYPE_BRUSH;
+            post_raster_command(ctx, save);
         }
-        else {
-            float radius = ctx->brush_size;
-            float radius_squared = radius * radius;
-
-            float dx = ctx->current_mouse_pos.x - ctx->previous_mouse_pos.x;
-            float dy = ctx->current_mouse_pos.y - ctx->previous_mouse_pos.y;
-
-            float screen_dist_squared = dx * dx + dy * dy;
-            float radius_scale = Clamp(ctx->camera.zoom / 64.0f, 0.1f, 0.5f);
-
-            if (screen_dist_squared >= radius_squared * radius_scale) {
-                /* Need for filling in */
-                int32_t lerp_count = screen_dist_squared / (radius_squared * radius_scale);
-                if (lerp_count > 0) {
-                    Vector2 prev_world = GetScreenToWorld2D(ctx->previous_mouse_pos, ctx->camera);
-                    Vector2 curr_world = GetScreenToWorld2D(ctx->current_mouse_pos, ctx->camera);
 
-                    float lerp_t = 0.0f;
+        RasterCommand command = {
+            .radius = ctx->brush_size,
+            .color = pack_color(ctx->draw_color),
+        };
 
-                    for (int32_t i = 0; i <= lerp_count; i++) {
-                        lerp_t = (float)i / lerp_count;
-                        Vector2 pos_world = Vector2Lerp(prev_world, curr_world, lerp_t);
+        if (filling) {
+            /* Filling the same pixel every frame again would just pile up work for the worker */
+            Vector2I pos_image = screen_to_image_space(ctx, mouse, dst);
+            if (!first_time && pos_image.x == ctx->fill_pos.x && pos_image.y == ctx->fill_pos.y) return;
+            ctx->fill_pos = pos_image;
 
-                        draw_circle(ctx, pos_world, dst, ctx->draw_color);
-                    }
-                }
+            command.type = RASTER_COMMAND_FILL;
+            command.x0 = pos_image.x;
+            command.y0 = pos_image.y;
+            post_raster_command(ctx, command);
+        }
+        else if (first_time) {
+            /* The first frame of a stroke shouldnt connect to where the mouse was before */
+            Vector2I pos_image = screen_to_image_space(ctx, mouse, dst);
+            command.type = RASTER_COMMAND_DISC;
+            command.x0 = pos_image.x;
+            command.y0 = pos_image.y;
+            post_raster_command(ctx, command);
+            ctx->stroke_pos = ctx->current_mouse_pos;
+        }
+        else {
+            /* One capsule per sample, the camera can move during a stroke so they stay in window space until here */
+            command.type = RASTER_COMMAND_STROKE;
+            Vector2I from = screen_to_image_space(ctx, GetScreenToWorld2D(ctx->stroke_pos, ctx->camera), dst);
+            for (uint32_t i = 0; i < ctx->input_sample_count; i++) {
+                InputSample* sample = &ctx->input_samples[i];
+                Vector2I to = screen_to_image_space(ctx, GetScreenToWorld2D((Vector2){ sample->x, sample->y }, ctx->camera), dst);
+                command.x0 = from.x;
+                command.y0 = from.y;
+                command.x1 = to.x;
+                command.y1 = to.y;
+                post_raster_command(ctx, command);
+                from = to;
+                ctx->stroke_pos = (Vector2){ sample->x, sample->y };
             }
-
-            draw_circle(ctx, mouse, dst, ctx->draw_color);
         }
-
-        UpdateTexture(ctx->loaded_tex, ctx->image_data);
     }
 }
 
-static void undo(Context* ctx) {
-    int32_t idx = ctx->save_states_index - 1;
-    if (idx < 0) {
-        idx = UNDO_COUNT - 1;
-    }
-
-    if (!ctx->save_states[idx].valid) {
-        fprintf(stderr, "No valid safe state anymore\n");
+#ifndef DRAW_BENCH /* Only the window loop uses these */
+/*
+   Cursor positions since the last frame as a polyline. Samples closer than
+   a pixel to the previous one get merged into it. Without the sampler
+   thread this is just the position of this frame if the mouse moved.
+*/
+static void collect_input_samples(Context* ctx) {
+    ctx->input_sample_count = 0;
+
+    if (!ctx->input) {
+        if (!Vector2Equals(ctx->current_mouse_pos, ctx->previous_mouse_pos)) {
+            ctx->input_samples[ctx->input_sample_count++] = (InputSample){ ctx->current_mouse_pos.x, ctx->current_mouse_pos.y, platGetTime() };
+        }
         return;
     }
-    
-    switch (ctx->save_states[idx].type) {
-        case SAVE_STATE_TYPE_BRUSH: {
-            PixelState* pixels = ctx->save_states[idx].data.brush.pixels;
-            Rectangle dst = get_image_dst(ctx);
-
-            for (int32_t i = 0; i < darrayLength(pixels); i++) {
-                PixelState* p = &pixels[i];
-                write_pixel(ctx, p->index, p->color);
+
+    InputSample sample;
+    while (input_queue_pop(&ctx->input->queue, &sample)) {
+        uint32_t count = ctx->input_sample_count;
+        if (count > 0) {
+            InputSample* last = &ctx->input_samples[count - 1];
+            float dx = sample.x - last->x;
+            float dy = sample.y - last->y;
+            if (dx * dx + dy * dy < 1.0f || count == INPUT_QUEUE_SIZE) {
+                *last = sample;
+                continue;
             }
-            darrayDestroy(pixels);
-        };
-        default:
-            break;
+        }
+        ctx->input_samples[ctx->input_sample_count++] = sample;
     }
+}
 
-    ctx->save_states_index--;
-    if (ctx->save_states_index < 0) ctx->save_states_index = UNDO_COUNT - 1;
-    ctx->save_states[ctx->save_states_index].valid = false;
-
-    UpdateTexture(ctx->loaded_tex, ctx->image_data);
+/* Frame time breakdown in screen space, drawn over everything in debug mode */
+static void draw_profiler_overlay(Context* ctx) {
+    if (!ctx->profiler) return;
+
+    double zone_ms[PROFILE_ZONE_COUNT];
+    double frame_ms;
+    uint32_t frames = profiler_averages(ctx->profiler, PROFILER_OVERLAY_FRAMES, zone_ms, &frame_ms);
+    if (frames == 0) return;
+
+    const int32_t font_size = 10;
+    const int32_t line_height = 14;
+    const int32_t bar_width = 100;
+    int32_t x = 10;
+    int32_t y = 40;
+
+    DrawRectangle(x - 5, y - 5, 330, (PROFILE_ZONE_COUNT + 2) * line_height + 10, Fade(BLACK, 0.75f));
+    DrawText(TextFormat("frame %.2f ms, avg of %u frames, T dumps a trace", frame_ms, frames), x, y, font_size, RAYWHITE);
+
+    /* Whatever isnt in a zone, mostly waiting for the swap */
+    double other_ms = frame_ms;
+    for (int32_t zone = 0; zone < PROFILE_ZONE_COUNT; zone++) other_ms -= zone_ms[zone];
+
+    for (int32_t zone = 0; zone <= PROFILE_ZONE_COUNT; zone++) {
+        bool other = zone == PROFILE_ZONE_COUNT;
+        double ms = other ? MAX(other_ms, 0.0) : zone_ms[zone];
+        float share = frame_ms > 0.0 ? (float)(ms / frame_ms) : 0.0f;
+        y += line_height;
+
+        DrawRectangle(x, y + 2, (int32_t)(bar_width * share), line_height - 4, other ? GRAY : ORANGE);
+        DrawText(other ? "other" : profiler_zone_name(zone), x + bar_width + 10, y, font_size, RAYWHITE);
+        DrawText(TextFormat("%.3f ms", ms), x + bar_width + 140, y, font_size, RAYWHITE);
+    }
 }
 
-static void redo(Context* ctx) {
+static void dump_profiler_trace(Context* ctx) {
+    if (!ctx->profiler) return;
 
+    const char* path = TextFormat("trace_%lld.json", (long long)time(NULL));
+    if (profiler_write_trace(ctx->profiler, path)) {
+        printf("Wrote trace of the last %d frames to %s\n", PROFILER_FRAME_COUNT, path);
+    }
 }
 
 static void handle_input(Context* ctx) {
@@ -739,6 +1232,9 @@ static void handle_input(Context* ctx) {
     if (IsKeyPressed(KEY_D)) {
         ctx->debug_mode = !ctx->debug_mode;
     }
+    if (ctx->debug_mode && IsKeyPressed(KEY_T)) {
+        dump_profiler_trace(ctx);
+    }
 
     if (IsKeyDown(KEY_LEFT_SHIFT)) {
         ctx->draw_brush_size_debug = true;
@@ -751,17 +1247,21 @@ static void handle_input(Context* ctx) {
 
     /* Undo/Redo */
     if (ctrl && IsKeyPressed(KEY_Y)) { // German Keyboard layout
-            undo(ctx);
+            post_raster_command(ctx, (RasterCommand){ .type = RASTER_COMMAND_UNDO });
     }
     else if (ctrl && IsKeyPressed(KEY_R)) {
-            redo(ctx);
+            post_raster_command(ctx, (RasterCommand){ .type = RASTER_COMMAND_REDO });
     }
 
     if (CheckCollisionPointRec(GetMousePosition(), ctx->ui_state.bounding_box)) {
         ctx->above_ui = true;
     }
 }
+#endif
 
+#ifdef DRAW_BENCH
+#include "bench.c"
+#else
 int32_t main() {
     Context ctx = { .window_width = 1200, .window_height = 800, .ui_state = {0} };
 
@@ -799,6 +1299,12 @@ int32_t main() {
     ctx.brush_size = 2.0f;
     ctx.camera.zoom = 1.0f;
     ctx.export_scale = 1.0f;
+    ctx.scratch_arena = arenaCreate(GiB(1), MiB(1));
+    ctx.history = history_create(HISTORY_BUDGET, release_save_state, &ctx);
+
+    ctx.input = input_sampler_create(GetWindowHandle());
+    ctx.raster = raster_worker_create(execute_raster_command, &ctx);
+    ctx.profiler = profiler_create();
 
     generate_rainbow_circle(&ctx.rainbow_circle);
 
@@ -807,17 +1313,20 @@ int32_t main() {
     float ui_click_cooldown = UI_CLICK_COOLDOWN;
 
     while (!WindowShouldClose()) {
+        profiler_begin_frame(ctx.profiler);
+
         ctx.window_width = GetScreenWidth();
         ctx.window_height = GetScreenHeight();
 
         ctx.previous_mouse_pos = ctx.current_mouse_pos;
         ctx.current_mouse_pos = GetMousePosition();
+        collect_input_samples(&ctx);
 
         ctx.above_ui = false;
 
-        handle_input(&ctx);
-        update_ui(&ctx); /* Important order of func calls here DONT CHANGE!! */
-        compute_clay_layout(&ctx, ui_images, ARRAY_LEN(ui_images));
+        PROFILE(ctx.profiler, PROFILE_ZONE_HANDLE_INPUT, handle_input(&ctx));
+        PROFILE(ctx.profiler, PROFILE_ZONE_UPDATE_UI, update_ui(&ctx)); /* Important order of func calls here DONT CHANGE!! */
+        PROFILE(ctx.profiler, PROFILE_ZONE_COMPUTE_CLAY_LAYOUT, compute_clay_layout(&ctx, ui_images, ARRAY_LEN(ui_images)));
 
         if (ctx.enalbe_ui_click_cooldown) {
             ctx.above_ui = true;
@@ -829,13 +1338,20 @@ int32_t main() {
             }
         }
 
-        update_image_data(&ctx);
+        PROFILE(ctx.profiler, PROFILE_ZONE_UPDATE_IMAGE_DATA, update_image_data(&ctx));
+
+        /* If the worker is busy the old textures get drawn and the upload waits for the next frame */
+        ctx.canvas_locked = !ctx.raster || raster_worker_try_lock(ctx.raster);
+        if (ctx.canvas_locked) PROFILE(ctx.profiler, PROFILE_ZONE_UPLOAD, upload_dirty_region(&ctx));
 
         BeginDrawing();
         ClearBackground(ctx.clear_color);
         BeginMode2D(ctx.camera);
 
-        draw_image(&ctx);
+        PROFILE(ctx.profiler, PROFILE_ZONE_DRAW_IMAGE, draw_image(&ctx));
+
+        if (ctx.canvas_locked && ctx.raster) raster_worker_unlock(ctx.raster);
+        ctx.canvas_locked = false;
     
         if (ctx.draw_brush_size_debug) {
             Vector2 world_pos = GetScreenToWorld2D(GetMousePosition(), ctx.camera);
@@ -852,16 +1368,24 @@ int32_t main() {
 
         EndMode2D();
 
-        draw_ui(&ctx, fonts);
+        PROFILE(ctx.profiler, PROFILE_ZONE_DRAW_UI, draw_ui(&ctx, fonts));
+        if (ctx.debug_mode) draw_profiler_overlay(&ctx);
 
         EndDrawing();
+
+        profiler_end_frame(ctx.profiler);
     }
 
-    if (ctx.image_data) free(ctx.image_data);
-    UnloadTexture(ctx.loaded_tex);
+    input_sampler_destroy(ctx.input);
+    raster_worker_destroy(ctx.raster);
+    profiler_destroy(ctx.profiler);
+    free_canvas(&ctx);
+    if (ctx.upload_buffer) free(ctx.upload_buffer);
+    arenaDestroy(ctx.scratch_arena);
+    history_destroy(ctx.history);
 
     Clay_Raylib_Close();
 
     return 0;
 }
-
+#endif
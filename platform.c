@@ -0,0 +1,256 @@
+
+#include "platform.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <psapi.h>
+#include <limits.h>
+
+struct PlatThread {
+    HANDLE handle;
+    PFN_platThreadFunc func;
+    void* user_data;
+};
+
+double platGetTime(void) {
+    static LARGE_INTEGER frequency = {0};
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+uint32_t platGetCoreCount(void) {
+    SYSTEM_INFO sysInfo = {0};
+    GetSystemInfo(&sysInfo);
+    return sysInfo.dwNumberOfProcessors;
+}
+
+void platSleep(double seconds) {
+    Sleep((DWORD)(seconds * 1000.0));
+}
+
+uint64_t platGetPeakMemory(void) {
+    PROCESS_MEMORY_COUNTERS counters = {0};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+}
+
+bool platGetCursorPos(void* window, float* x, float* y) {
+    POINT point;
+    if (!GetCursorPos(&point) || !ScreenToClient((HWND)window, &point)) return false;
+    *x = (float)point.x;
+    *y = (float)point.y;
+    return true;
+}
+
+static DWORD WINAPI platThreadEntry(LPVOID param) {
+    PlatThread* thread = (PlatThread*)param;
+    thread->func(thread->user_data);
+    return 0;
+}
+
+PlatThread* platThreadCreate(PFN_platThreadFunc func, void* user_data) {
+    PlatThread* thread = malloc(sizeof(PlatThread));
+    if (!thread) return NULL;
+
+    thread->func = func;
+    thread->user_data = user_data;
+    thread->handle = CreateThread(NULL, 0, platThreadEntry, thread, 0, NULL);
+    if (!thread->handle) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void platThreadJoin(PlatThread* thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+}
+
+struct PlatMutex {
+    CRITICAL_SECTION lock;
+};
+
+PlatMutex* platMutexCreate(void) {
+    PlatMutex* mutex = malloc(sizeof(PlatMutex));
+    if (mutex) InitializeCriticalSection(&mutex->lock);
+    return mutex;
+}
+
+void platMutexDestroy(PlatMutex* mutex) {
+    DeleteCriticalSection(&mutex->lock);
+    free(mutex);
+}
+
+void platMutexLock(PlatMutex* mutex) {
+    EnterCriticalSection(&mutex->lock);
+}
+
+bool platMutexTryLock(PlatMutex* mutex) {
+    return TryEnterCriticalSection(&mutex->lock) != 0;
+}
+
+void platMutexUnlock(PlatMutex* mutex) {
+    LeaveCriticalSection(&mutex->lock);
+}
+
+struct PlatSemaphore {
+    HANDLE handle;
+};
+
+PlatSemaphore* platSemaphoreCreate(void) {
+    PlatSemaphore* semaphore = malloc(sizeof(PlatSemaphore));
+    if (!semaphore) return NULL;
+
+    semaphore->handle = CreateSemaphoreA(NULL, 0, LONG_MAX, NULL);
+    if (!semaphore->handle) {
+        free(semaphore);
+        return NULL;
+    }
+    return semaphore;
+}
+
+void platSemaphoreDestroy(PlatSemaphore* semaphore) {
+    CloseHandle(semaphore->handle);
+    free(semaphore);
+}
+
+void platSemaphorePost(PlatSemaphore* semaphore) {
+    ReleaseSemaphore(semaphore->handle, 1, NULL);
+}
+
+void platSemaphoreWait(PlatSemaphore* semaphore) {
+    WaitForSingleObject(semaphore->handle, INFINITE);
+}
+
+#elif __linux__
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/resource.h>
+
+struct PlatThread {
+    pthread_t handle;
+    PFN_platThreadFunc func;
+    void* user_data;
+};
+
+double platGetTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+uint32_t platGetCoreCount(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+void platSleep(double seconds) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+uint64_t platGetPeakMemory(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (uint64_t)usage.ru_maxrss * 1024; /* Linux reports KiB */
+}
+
+/* Would need the X11 / Wayland connection glfw keeps to itself */
+bool platGetCursorPos(void* window, float* x, float* y) {
+    (void)window; (void)x; (void)y;
+    return false;
+}
+
+static void* platThreadEntry(void* param) {
+    PlatThread* thread = (PlatThread*)param;
+    thread->func(thread->user_data);
+    return NULL;
+}
+
+PlatThread* platThreadCreate(PFN_platThreadFunc func, void* user_data) {
+    PlatThread* thread = malloc(sizeof(PlatThread));
+    if (!thread) return NULL;
+
+    thread->func = func;
+    thread->user_data = user_data;
+    if (pthread_create(&thread->handle, NULL, platThreadEntry, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void platThreadJoin(PlatThread* thread) {
+    pthread_join(thread->handle, NULL);
+    free(thread);
+}
+
+struct PlatMutex {
+    pthread_mutex_t lock;
+};
+
+PlatMutex* platMutexCreate(void) {
+    PlatMutex* mutex = malloc(sizeof(PlatMutex));
+    if (mutex && pthread_mutex_init(&mutex->lock, NULL) != 0) {
+        free(mutex);
+        return NULL;
+    }
+    return mutex;
+}
+
+void platMutexDestroy(PlatMutex* mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+    free(mutex);
+}
+
+void platMutexLock(PlatMutex* mutex) {
+    pthread_mutex_lock(&mutex->lock);
+}
+
+bool platMutexTryLock(PlatMutex* mutex) {
+    return pthread_mutex_trylock(&mutex->lock) == 0;
+}
+
+void platMutexUnlock(PlatMutex* mutex) {
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+struct PlatSemaphore {
+    sem_t handle;
+};
+
+PlatSemaphore* platSemaphoreCreate(void) {
+    PlatSemaphore* semaphore = malloc(sizeof(PlatSemaphore));
+    if (semaphore && sem_init(&semaphore->handle, 0, 0) != 0) {
+        free(semaphore);
+        return NULL;
+    }
+    return semaphore;
+}
+
+void platSemaphoreDestroy(PlatSemaphore* semaphore) {
+    sem_destroy(&semaphore->handle);
+    free(semaphore);
+}
+
+void platSemaphorePost(PlatSemaphore* semaphore) {
+    sem_post(&semaphore->handle);
+}
+
+void platSemaphoreWait(PlatSemaphore* semaphore) {
+    while (sem_wait(&semaphore->handle) != 0) {} /* Interrupted by a signal */
+}
+
+#endif
@@ -0,0 +1,46 @@
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct PlatThread PlatThread;
+typedef struct PlatMutex PlatMutex;
+typedef struct PlatSemaphore PlatSemaphore;
+typedef void (*PFN_platThreadFunc)(void* user_data);
+
+/* Monotonic clock in seconds, only useful for measuring durations */
+double platGetTime(void);
+
+uint32_t platGetCoreCount(void);
+
+void platSleep(double seconds);
+
+/* Peak resident memory of the process in bytes, 0 if it isnt known */
+uint64_t platGetPeakMemory(void);
+
+/*
+   Cursor position relative to the client area of window (the native handle
+   raylib gives out), can be called from any thread. Returns false where
+   that isnt supported.
+*/
+bool platGetCursorPos(void* window, float* x, float* y);
+
+/* Returns NULL if the thread couldnt be started */
+PlatThread* platThreadCreate(PFN_platThreadFunc func, void* user_data);
+/* Waits for the thread to finish and frees it */
+void platThreadJoin(PlatThread* thread);
+
+PlatMutex* platMutexCreate(void);
+void platMutexDestroy(PlatMutex* mutex);
+void platMutexLock(PlatMutex* mutex);
+bool platMutexTryLock(PlatMutex* mutex);
+void platMutexUnlock(PlatMutex* mutex);
+
+PlatSemaphore* platSemaphoreCreate(void);
+void platSemaphoreDestroy(PlatSemaphore* semaphore);
+void platSemaphorePost(PlatSemaphore* semaphore);
+void platSemaphoreWait(PlatSemaphore* semaphore);
+
+#endif
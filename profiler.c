@@ -0,0 +1,120 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "platform.h"
+
+static const char* zone_names[PROFILE_ZONE_COUNT] = {
+    [PROFILE_ZONE_HANDLE_INPUT] = "handle_input",
+    [PROFILE_ZONE_UPDATE_UI] = "update_ui",
+    [PROFILE_ZONE_COMPUTE_CLAY_LAYOUT] = "compute_clay_layout",
+    [PROFILE_ZONE_UPDATE_IMAGE_DATA] = "update_image_data",
+    [PROFILE_ZONE_UPLOAD] = "UpdateTexture",
+    [PROFILE_ZONE_DRAW_IMAGE] = "draw_image",
+    [PROFILE_ZONE_DRAW_UI] = "draw_ui",
+};
+
+Profiler* profiler_create(void) {
+    Profiler* profiler = calloc(1, sizeof(Profiler));
+    if (!profiler) return NULL;
+
+    profiler->frame = &profiler->frames[0];
+    profiler->start_ticks = profiler_ticks();
+    profiler->start_time = platGetTime();
+    return profiler;
+}
+
+void profiler_destroy(Profiler* profiler) {
+    free(profiler);
+}
+
+void profiler_begin_frame(Profiler* profiler) {
+    if (!profiler) return;
+    ProfileFrame* frame = &profiler->frames[profiler->frame_count & (PROFILER_FRAME_COUNT - 1)];
+    frame->record_count = 0;
+    frame->begin = profiler_ticks();
+    profiler->frame = frame;
+
+    /* The longer the app runs the more exact this gets */
+    double elapsed = platGetTime() - profiler->start_time;
+    if (elapsed > 0.0) profiler->ticks_per_second = (frame->begin - profiler->start_ticks) / elapsed;
+}
+
+void profiler_end_frame(Profiler* profiler) {
+    if (!profiler) return;
+    profiler->frame->end = profiler_ticks();
+    profiler->frame_count++;
+}
+
+const char* profiler_zone_name(enum ProfileZone zone) {
+    return zone < PROFILE_ZONE_COUNT ? zone_names[zone] : "unknown";
+}
+
+static inline double ticks_to_ms(const Profiler* profiler, uint64_t ticks) {
+    return profiler->ticks_per_second > 0.0 ? ticks * 1e3 / profiler->ticks_per_second : 0.0;
+}
+
+/* Microseconds since the profiler was created, what the trace format wants */
+static inline double ticks_to_trace_us(const Profiler* profiler, uint64_t ticks) {
+    return ticks_to_ms(profiler, ticks - profiler->start_ticks) * 1e3;
+}
+
+static inline uint64_t record_ticks(const ProfileRecord* record) {
+    return record->end > record->begin ? record->end - record->begin : 0;
+}
+
+uint32_t profiler_averages(const Profiler* profiler, uint32_t frame_count, double zone_ms[PROFILE_ZONE_COUNT], double* frame_ms) {
+    if (frame_count > PROFILER_FRAME_COUNT) frame_count = PROFILER_FRAME_COUNT;
+    if (frame_count > profiler->frame_count) frame_count = (uint32_t)profiler->frame_count;
+
+    uint64_t zone_ticks[PROFILE_ZONE_COUNT] = {0};
+    uint64_t frame_ticks = 0;
+
+    for (uint32_t i = 1; i <= frame_count; i++) {
+        const ProfileFrame* frame = &profiler->frames[(profiler->frame_count - i) & (PROFILER_FRAME_COUNT - 1)];
+        frame_ticks += frame->end - frame->begin;
+        for (uint32_t r = 0; r < frame->record_count; r++) {
+            zone_ticks[frame->records[r].zone] += record_ticks(&frame->records[r]);
+        }
+    }
+
+    double scale = frame_count > 0 ? 1.0 / frame_count : 0.0;
+    for (int32_t zone = 0; zone < PROFILE_ZONE_COUNT; zone++) zone_ms[zone] = ticks_to_ms(profiler, zone_ticks[zone]) * scale;
+    *frame_ms = ticks_to_ms(profiler, frame_ticks) * scale;
+    return frame_count;
+}
+
+bool profiler_write_trace(const Profiler* profiler, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    uint64_t frame_count = profiler->frame_count < PROFILER_FRAME_COUNT ? profiler->frame_count : PROFILER_FRAME_COUNT;
+    bool first = true;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (uint64_t index = profiler->frame_count - frame_count; index < profiler->frame_count; index++) {
+        const ProfileFrame* frame = &profiler->frames[index & (PROFILER_FRAME_COUNT - 1)];
+
+        fprintf(file, "%s{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"index\":%llu}}",
+                first ? "" : ",\n", ticks_to_trace_us(profiler, frame->begin),
+                ticks_to_ms(profiler, frame->end - frame->begin) * 1e3, (unsigned long long)index);
+        first = false;
+
+        for (uint32_t r = 0; r < frame->record_count; r++) {
+            const ProfileRecord* record = &frame->records[r];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                    profiler_zone_name(record->zone), ticks_to_trace_us(profiler, record->begin),
+                    ticks_to_ms(profiler, record_ticks(record)) * 1e3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Failed to write %s\n", path);
+    return ok;
+}
@@ -0,0 +1,110 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define PROFILER_HAS_TSC 1
+#else
+#include "platform.h"
+#endif
+
+#define PROFILER_FRAME_COUNT 256 /* Frames kept for the overlay and the trace, power of two */
+#define PROFILER_MAX_RECORDS 64 /* Zones per frame, the rest isnt recorded */
+
+enum ProfileZone {
+    PROFILE_ZONE_HANDLE_INPUT,
+    PROFILE_ZONE_UPDATE_UI,
+    PROFILE_ZONE_COMPUTE_CLAY_LAYOUT,
+    PROFILE_ZONE_UPDATE_IMAGE_DATA,
+    PROFILE_ZONE_UPLOAD,
+    PROFILE_ZONE_DRAW_IMAGE,
+    PROFILE_ZONE_DRAW_UI,
+    PROFILE_ZONE_COUNT,
+};
+
+typedef struct ProfileRecord {
+    uint32_t zone;
+    uint64_t begin;
+    uint64_t end;
+} ProfileRecord;
+
+typedef struct ProfileFrame {
+    uint64_t begin;
+    uint64_t end;
+    uint32_t record_count;
+    ProfileRecord records[PROFILER_MAX_RECORDS];
+} ProfileFrame;
+
+/*
+   Per frame timing zones for the main thread. Recording a zone only reads
+   the cycle counter and writes into the current frame of a fixed ring, so
+   it stays on in release builds. Ticks get turned into time afterwards,
+   the tick rate is measured against platGetTime while the app runs.
+*/
+typedef struct Profiler {
+    ProfileFrame frames[PROFILER_FRAME_COUNT];
+    ProfileFrame* frame; /* The one being recorded */
+    uint64_t frame_count; /* Frames finished so far */
+
+    uint64_t start_ticks;
+    double start_time;
+    double ticks_per_second;
+} Profiler;
+
+static inline uint64_t profiler_ticks(void) {
+#ifdef PROFILER_HAS_TSC
+    return __rdtsc();
+#else
+    return (uint64_t)(platGetTime() * 1e9);
+#endif
+}
+
+Profiler* profiler_create(void);
+void profiler_destroy(Profiler* profiler);
+
+void profiler_begin_frame(Profiler* profiler);
+void profiler_end_frame(Profiler* profiler);
+
+/* Returns the record to pass to profiler_end, profiler can be NULL */
+static inline uint32_t profiler_begin(Profiler* profiler, enum ProfileZone zone) {
+    if (!profiler) return PROFILER_MAX_RECORDS;
+    ProfileFrame* frame = profiler->frame;
+    uint32_t record = frame->record_count;
+    if (record == PROFILER_MAX_RECORDS) return record;
+
+    frame->record_count++;
+    frame->records[record] = (ProfileRecord){ zone, profiler_ticks(), 0 };
+    return record;
+}
+
+static inline void profiler_end(Profiler* profiler, uint32_t record) {
+    if (record < PROFILER_MAX_RECORDS) profiler->frame->records[record].end = profiler_ticks();
+}
+
+/* Times one statement, PROFILE(profiler, PROFILE_ZONE_DRAW_UI, draw_ui(ctx, fonts)); */
+#define PROFILE(profiler, zone, statement) \
+    do { \
+        uint32_t profile_record_ = profiler_begin(profiler, zone); \
+        statement; \
+        profiler_end(profiler, profile_record_); \
+    } while (0)
+
+const char* profiler_zone_name(enum ProfileZone zone);
+
+/*
+   Average milliseconds per zone and per frame over the last frame_count
+   finished frames. Returns how many frames there actually were.
+*/
+uint32_t profiler_averages(const Profiler* profiler, uint32_t frame_count, double zone_ms[PROFILE_ZONE_COUNT], double* frame_ms);
+
+/* Writes the finished frames in the ring as chrome trace event json (chrome://tracing, Perfetto) */
+bool profiler_write_trace(const Profiler* profiler, const char* path);
+
+#endif
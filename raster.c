@@ -0,0 +1,87 @@
+#include "raster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RASTER_WAIT_INTERVAL (1.0 / 2000.0)
+
+static bool queue_push(RasterQueue* queue, const RasterCommand* command) {
+    return ring_push(&queue->ring, queue->commands, RASTER_QUEUE_SIZE, sizeof(RasterCommand), command);
+}
+
+static bool queue_pop(RasterQueue* queue, RasterCommand* command) {
+    return ring_pop(&queue->ring, queue->commands, RASTER_QUEUE_SIZE, sizeof(RasterCommand), command);
+}
+
+static void run_worker(void* user_data) {
+    RasterWorker* worker = user_data;
+
+    for (;;) {
+        platSemaphoreWait(worker->wake);
+
+        RasterCommand command;
+        while (queue_pop(&worker->queue, &command)) {
+            platMutexLock(worker->lock);
+            worker->execute(&command, worker->user_data);
+            platMutexUnlock(worker->lock);
+            atomic_fetch_sub_explicit(&worker->pending, 1, memory_order_release);
+        }
+
+        if (!atomic_load(&worker->running)) break;
+    }
+}
+
+RasterWorker* raster_worker_create(PFN_rasterExecute execute, void* user_data) {
+    RasterWorker* worker = calloc(1, sizeof(RasterWorker));
+    if (!worker) return NULL;
+
+    worker->execute = execute;
+    worker->user_data = user_data;
+    worker->lock = platMutexCreate();
+    worker->wake = platSemaphoreCreate();
+    atomic_store(&worker->running, true);
+    if (worker->lock && worker->wake) worker->thread = platThreadCreate(run_worker, worker);
+
+    if (!worker->thread) {
+        fprintf(stderr, "Failed to start raster thread, painting on the main thread\n");
+        if (worker->lock) platMutexDestroy(worker->lock);
+        if (worker->wake) platSemaphoreDestroy(worker->wake);
+        free(worker);
+        return NULL;
+    }
+    return worker;
+}
+
+void raster_worker_destroy(RasterWorker* worker) {
+    if (!worker) return;
+
+    atomic_store(&worker->running, false);
+    platSemaphorePost(worker->wake);
+    platThreadJoin(worker->thread);
+
+    platMutexDestroy(worker->lock);
+    platSemaphoreDestroy(worker->wake);
+    free(worker);
+}
+
+void raster_worker_push(RasterWorker* worker, RasterCommand command) {
+    atomic_fetch_add_explicit(&worker->pending, 1, memory_order_relaxed);
+    while (!queue_push(&worker->queue, &command)) platSleep(RASTER_WAIT_INTERVAL);
+    platSemaphorePost(worker->wake);
+}
+
+void raster_worker_wait(RasterWorker* worker) {
+    while (atomic_load_explicit(&worker->pending, memory_order_acquire) > 0) platSleep(RASTER_WAIT_INTERVAL);
+}
+
+void raster_worker_lock(RasterWorker* worker) {
+    platMutexLock(worker->lock);
+}
+
+bool raster_worker_try_lock(RasterWorker* worker) {
+    return platMutexTryLock(worker->lock);
+}
+
+void raster_worker_unlock(RasterWorker* worker) {
+    platMutexUnlock(worker->lock);
+}
@@ -0,0 +1,74 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "platform.h"
+#include "ring.h"
+
+#define RASTER_QUEUE_SIZE 4096 /* Power of two */
+
+enum RasterCommandType {
+    RASTER_COMMAND_SAVE_STATE,
+    RASTER_COMMAND_DISC,
+    RASTER_COMMAND_STROKE,
+    RASTER_COMMAND_FILL,
+    RASTER_COMMAND_UNDO,
+    RASTER_COMMAND_REDO,
+};
+
+/* Everything in image space, the worker never looks at the camera or the UI */
+typedef struct RasterCommand {
+    uint32_t type;
+    uint32_t kind; /* SaveStateType for RASTER_COMMAND_SAVE_STATE */
+    int32_t x0, y0;
+    int32_t x1, y1;
+    float radius;
+    uint32_t color; /* Packed Color */
+} RasterCommand;
+
+/* Filled by the main thread, emptied by the worker */
+typedef struct RasterQueue {
+    RasterCommand commands[RASTER_QUEUE_SIZE];
+    Ring ring;
+} RasterQueue;
+
+typedef void (*PFN_rasterExecute)(const RasterCommand* command, void* user_data);
+
+/*
+   Thread that owns the canvas pixels. The main thread pushes paint commands
+   and the worker runs them one at a time while holding lock. The main thread
+   only takes the lock when it reads the canvas (uploads, color picking) and
+   uses raster_worker_try_lock for the per frame upload, so a long fill just
+   delays the upload instead of the frame.
+*/
+typedef struct RasterWorker {
+    RasterQueue queue;
+    PlatThread* thread;
+    PlatMutex* lock;
+    PlatSemaphore* wake;
+
+    PFN_rasterExecute execute;
+    void* user_data;
+
+    _Atomic bool running;
+    _Atomic uint32_t pending; /* Pushed commands that didnt finish yet */
+} RasterWorker;
+
+/* NULL if the thread couldnt be started, callers run the commands themselves then */
+RasterWorker* raster_worker_create(PFN_rasterExecute execute, void* user_data);
+/* Runs what is still queued before stopping */
+void raster_worker_destroy(RasterWorker* worker);
+
+/* Waits for room if the queue is full */
+void raster_worker_push(RasterWorker* worker, RasterCommand command);
+/* Blocks until every pushed command ran, the canvas is the callers until the next push */
+void raster_worker_wait(RasterWorker* worker);
+
+void raster_worker_lock(RasterWorker* worker);
+bool raster_worker_try_lock(RasterWorker* worker);
+void raster_worker_unlock(RasterWorker* worker);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/*
+   Lock free ring with exactly one thread pushing and one popping. head is
+   only written by the producer and tail only by the consumer, each side
+   publishes its slots with a release store. The slots live next to the
+   Ring in the owning struct, capacity has to be a power of two.
+*/
+typedef struct Ring {
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+} Ring;
+
+/* false if the ring is full, the item is dropped then */
+static inline bool ring_push(Ring* ring, void* slots, uint32_t capacity, size_t stride, const void* item) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == capacity) return false;
+
+    memcpy((uint8_t*)slots + (head & (capacity - 1)) * stride, item, stride);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+static inline bool ring_pop(Ring* ring, const void* slots, uint32_t capacity, size_t stride, void* item) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) return false;
+
+    memcpy(item, (const uint8_t*)slots + (tail & (capacity - 1)) * stride, stride);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+#endif
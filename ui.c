@@ -54,11 +54,11 @@ void check_input_number(char* number, char* number_string) {
     }
 }
 
-void initzialize_img_alpha(Context* ctx) {
-    for (int32_t y = 0; y < ctx->new_image_height; y++) {
-        for (int32_t x = 0; x < ctx->new_image_width; x++) {
-            int32_t index = (y * ctx->new_image_width + x) * 4;
-            ctx->image_data[index + 3] = 255; 
+void initzialize_img_alpha(uint8_t* pixels, int32_t width, int32_t height) {
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            int32_t index = (y * width + x) * 4;
+            pixels[index + 3] = 255; 
         }
     }
 }
@@ -145,23 +145,18 @@ void utilities_open_image_dropdown_item_on_hover(Clay_ElementId element_id, Clay
             return;
         }
 
-        int32_t channels;
-        ctx->image_data = stbi_load(path, &ctx->new_image_width, &ctx->new_image_height, &channels, 4);
-        if (!ctx->image_data) {
+        int32_t width, height, channels;
+        uint8_t* pixels = stbi_load(path, &width, &height, &channels, 4);
+        if (!pixels) {
             fprintf(stderr, "Failed to create image in memory\n");
             return;
         }
-        initzialize_img_alpha(ctx);
+        initzialize_img_alpha(pixels, width, height);
 
-        Image img = GenImageColor(ctx->new_image_width, ctx->new_image_height, BLACK);
-        ctx->loaded_tex = LoadTextureFromImage(img);
-        UnloadImage(img);
-
-        SetTextureFilter(ctx->loaded_tex, TEXTURE_FILTER_POINT);
-        UpdateTexture(ctx->loaded_tex, ctx->image_data);
-
-        ctx->loaded_ratio = (float)ctx->loaded_tex.width / (float)ctx->loaded_tex.height;
-        ctx->mode = UI_MODE_IMAGE_EDITING;
+        if (!create_canvas(ctx, width, height, pixels)) {
+            fprintf(stderr, "Failed to load image %dx%d: %s\n", width, height, path);
+        }
+        stbi_image_free(pixels);
     }
 }
 
@@ -186,7 +181,7 @@ void utilities_export_image_dropdown_item_on_hover(Clay_ElementId element_id, Cl
             fprintf(stderr, "Failed to path from filedialog\n");
             return;
         }
-        stbi_write_png(path, ctx->new_image_width, ctx->new_image_height, 4, ctx->image_data, ctx->new_image_width * 4);
+        write_canvas_png(ctx, path);
     }
 }
 
@@ -334,34 +329,20 @@ void image_menu_close_on_hover(Clay_ElementId element_id, Clay_PointerData point
 void image_menu_create_on_hover(Clay_ElementId element_id, Clay_PointerData pointer_info, void* user_data) {
     Context* ctx = (Context*)user_data;
     if (pointer_info.state == CLAY_POINTER_DATA_PRESSED_THIS_FRAME) {
-        check_input_number("4000", ctx->ui_state.width_input.array);
-        check_input_number("4000", ctx->ui_state.height_input.array);
-
         ctx->ui_state.width_input.input = false;
         ctx->ui_state.height_input.input = false;
 
-        ctx->new_image_width = atoi(ctx->ui_state.width_input.array);
-        ctx->new_image_height = atoi(ctx->ui_state.height_input.array);
+        int32_t width = MIN(atoi(ctx->ui_state.width_input.array), CANVAS_MAX_SIZE);
+        int32_t height = MIN(atoi(ctx->ui_state.height_input.array), CANVAS_MAX_SIZE);
 
-        if (ctx->new_image_width == 0 || ctx->new_image_height == 0) return;
+        if (width == 0 || height == 0) return;
 
-        ctx->image_data = malloc(ctx->new_image_width * ctx->new_image_height * 4);
-        if (!ctx->image_data) {
+        /* Starts out as one color, tiles only get memory once painted */
+        if (!create_canvas(ctx, width, height, NULL)) {
             fprintf(stderr, "Memory allocation failed\n");
             return;
         }
 
-        memset(ctx->image_data, 0, ctx->new_image_width * ctx->new_image_height * 4);
-        initzialize_img_alpha(ctx);
-        Image img = GenImageColor(ctx->new_image_width, ctx->new_image_height, BLACK);
-        ctx->loaded_tex = LoadTextureFromImage(img);
-        UnloadImage(img);
-
-        SetTextureFilter(ctx->loaded_tex, TEXTURE_FILTER_POINT);
-        UpdateTexture(ctx->loaded_tex, ctx->image_data);
-
-        ctx->loaded_ratio = (float)ctx->loaded_tex.width / (float)ctx->loaded_tex.height;
-        ctx->mode = UI_MODE_IMAGE_EDITING;
         ctx->ui_state.image_menu.visible = false;
         ctx->enalbe_ui_click_cooldown = true;
     }
@@ -445,12 +426,12 @@ void compute_clay_new_image_menu(Context* ctx) {
                 .isStaticallyAllocated = true,
             };
             
-            clay_number_input_box(CLAY_STRING("Width"), dym_string, &ctx->ui_state.width_input.input, "4000");
+            clay_number_input_box(CLAY_STRING("Width"), dym_string, &ctx->ui_state.width_input.input, NULL);
 
             dym_string.chars = ctx->ui_state.height_input.array;
             dym_string.length = strlen(ctx->ui_state.height_input.array);
 
-            clay_number_input_box(CLAY_STRING("Height"), dym_string, &ctx->ui_state.height_input.input, "4000");
+            clay_number_input_box(CLAY_STRING("Height"), dym_string, &ctx->ui_state.height_input.input, NULL);
         }
 
         CLAY_AUTO_ID({
@@ -505,6 +486,7 @@ void export_js_menu_export_button_on_hover(Clay_ElementId element_id, Clay_Point
 
         ctx->export_scale = atoi(ctx->ui_state.scale_input.array);
         if (ctx->export_scale == 0) ctx->export_scale = 1.0f;
+        ctx->export_threads = MIN(atoi(ctx->ui_state.export_threads_input.array), JS_EXPORT_MAX_THREADS);
         image_to_javascript(ctx, file, ctx->ui_state.export_var_name_x.array, ctx->ui_state.export_var_name_y.array);
 
         fclose(file);
@@ -590,6 +572,28 @@ void compute_clay_export_js_menu(Context* ctx) {
 
             clay_number_input_box(CLAY_STRING("Name Var Y"), dym_text, &ctx->ui_state.export_var_name_y.input, NULL);
         }
+
+        CLAY_AUTO_ID({
+            .layout = {
+                .layoutDirection = CLAY_LEFT_TO_RIGHT,
+                .sizing = { CLAY_SIZING_GROW(0), CLAY_SIZING_FIT(0) },
+                .childAlignment = CLAY_ALIGN_X_CENTER,
+                .childGap = 24,
+            },
+        }) {
+            clay_checkbox(CLAY_STRING("Merge Rects"), &ctx->export_merge_rects);
+            clay_checkbox(CLAY_STRING("Palette"), &ctx->export_palette);
+            clay_checkbox(CLAY_STRING("Compress"), &ctx->export_compress);
+
+            /* Empty means one thread per core */
+            Clay_String dym_text = {
+                .chars = ctx->ui_state.export_threads_input.array,
+                .length = strlen(ctx->ui_state.export_threads_input.array),
+                .isStaticallyAllocated = true,
+            };
+
+            clay_number_input_box(CLAY_STRING("Threads"), dym_text, &ctx->ui_state.export_threads_input.input, NULL);
+        }
         
         clay_image_menu_button(CLAY_STRING("Export"), export_js_menu_export_button_on_hover, ctx);
     }
@@ -1300,12 +1304,12 @@ void update_ui(struct Context *ctx) {
     uiState* state = &ctx->ui_state;
     if (state->width_input.input) {
         state->height_input.input = false;
-        add_character_to_input_box(&state->width_input, "4000");
+        add_character_to_input_box(&state->width_input, NULL);
     }
 
     else if (state->height_input.input) {
         state->width_input.input = false;
-        add_character_to_input_box(&state->height_input, "4000");
+        add_character_to_input_box(&state->height_input, NULL);
     }
 
     /* Input Color Picker */
@@ -1337,6 +1341,9 @@ void update_ui(struct Context *ctx) {
         state->export_var_name_x.input = false;
         add_character_to_input_box(&state->export_var_name_y, NULL);
     }
+    else if (state->export_threads_input.input) {
+        add_character_to_input_box(&state->export_threads_input, NULL);
+    }
 
     /* Scale Input Box */ 
     if (state->scale_input.input) {
@@ -1392,6 +1399,7 @@ void init_ui(struct Context *ctx) {
     state->export_var_name_y.length = UI_EXPORT_VAR_NAME_MAX_INPUT_CHARS;
 
     state->scale_input.length = UI_COLOR_PICKER_MENU_MAX_INPUT_CHARS;
+    state->export_threads_input.length = UI_EXPORT_THREADS_MAX_INPUT_CHARS;
 
     state->width_input.type = UI_INPUT_BOX_TYPE_NUMBERS;
     state->height_input.type = UI_INPUT_BOX_TYPE_NUMBERS;
@@ -1404,5 +1412,6 @@ void init_ui(struct Context *ctx) {
     state->export_var_name_y.type = UI_INPUT_BOX_TYPE_ALL_ALHPA;
 
     state->scale_input.type = UI_INPUT_BOX_TYPE_NUMBERS;
+    state->export_threads_input.type = UI_INPUT_BOX_TYPE_NUMBERS;
 }
 